@@ -0,0 +1,77 @@
+#ifndef arcapplicationdata_h
+#define arcapplicationdata_h
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QCoreApplication>
+
+namespace Arc
+{
+
+    //* data shared by all decorations, that must not outlive the application, such as fonts and pixmaps
+    /**
+    the data is created on first use and released by a post routine. The holder, a static object,
+    releases it too when the plugin is unloaded before the application quits, so that no post
+    routine points to unloaded code. There is a single instance of the data per type
+    */
+    template<typename T>
+    class ApplicationData
+    {
+
+        public:
+
+        //* destructor
+        ~ApplicationData()
+        {
+            if( !s_data ) return;
+            qRemovePostRoutine( release );
+            release();
+        }
+
+        //* data, created on demand
+        T &get()
+        {
+            if( !s_data )
+            {
+                s_data = new T();
+                qAddPostRoutine( release );
+            }
+
+            return *s_data;
+        }
+
+        private:
+
+        //* release data
+        static void release()
+        {
+            delete s_data;
+            s_data = nullptr;
+        }
+
+        //* data
+        static T *s_data;
+
+    };
+
+    template<typename T>
+    T *ApplicationData<T>::s_data = nullptr;
+
+}
+
+#endif
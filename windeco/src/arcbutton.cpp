@@ -19,13 +19,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "arcbutton.h"
+#include "arcapplicationdata.h"
 
 #include <KDecoration2/DecoratedClient>
 #include <KColorUtils>
 #include <KIconLoader>
 
+#include <QCache>
 #include <QPainter>
 #include <QPainterPath>
+#include <QPixmap>
 #include <QVariantAnimation>
 
 namespace Arc
@@ -60,6 +63,56 @@ namespace Arc
     static const QColor DARK_BUTTON_CLOSE_HOVER_BG { "#d7787d" };
     static const QColor DARK_BUTTON_CLOSE_ACTIVE_BG { "#be3841" };
 
+    namespace
+    {
+        //* everything a button icon depends on
+        struct IconKey
+        {
+            int type;
+            int state;
+            QRgb background;
+            QRgb foreground;
+            QRgb border;
+            int size;
+            int scale;
+
+            bool operator == ( const IconKey &other ) const
+            {
+                return type == other.type && state == other.state &&
+                    background == other.background && foreground == other.foreground && border == other.border &&
+                    size == other.size && scale == other.scale;
+            }
+        };
+
+        inline uint qHash( const IconKey &key, uint seed = 0 )
+        {
+            return ::qHash( key.type | key.state << 8 | key.size << 16, seed ) ^
+                ::qHash( key.background ) ^ ::qHash( key.foreground << 1 ) ^ ::qHash( key.border << 2 ) ^ ::qHash( key.scale );
+        }
+
+        //*@name icon state bits
+        //@{
+        enum IconState
+        {
+            IconPressed = 1<<0,
+            IconHovered = 1<<1,
+            IconChecked = 1<<2,
+            IconCheckedCustom = 1<<3,
+            IconAurorae = 1<<4,
+            IconBackground = 1<<5,
+            IconForeground = 1<<6
+        };
+        //@}
+
+        //* button icons shared by all decorations, rendered at the device pixel ratio of the output they were painted on
+        struct Icons
+        {
+            QCache<IconKey, QPixmap> pixmaps{ 256 };
+        };
+
+        ApplicationData<Icons> g_sIcons;
+    }
+
     //__________________________________________________________________
     Button::Button(DecorationButtonType type, Decoration* decoration, QObject* parent)
         : DecorationButton(type, decoration, parent)
@@ -81,7 +134,6 @@ namespace Arc
         setIconSize(QSize( height, height ));
 
         // connections
-        connect(decoration->client().toStrongRef().data(), SIGNAL(iconChanged(QIcon)), this, SLOT(update()));
         connect(decoration->settings().data(), &KDecoration2::DecorationSettings::reconfigured, this, &Button::reconfigure);
         connect( this, &KDecoration2::DecorationButton::hoveredChanged, this, &Button::updateAnimationState );
 
@@ -136,10 +188,6 @@ namespace Arc
                     QObject::connect(strongPtr.data(), &KDecoration2::DecoratedClient::shadeableChanged, b, &Arc::Button::setVisible );
                     break;
 
-                    case DecorationButtonType::Menu:
-                    QObject::connect(strongPtr.data(), &KDecoration2::DecoratedClient::iconChanged, b, [b]() { b->update(); });
-                    break;
-
                     default: break;
 
                 }
@@ -163,10 +211,12 @@ namespace Arc
     //__________________________________________________________________
     void Button::paint(QPainter *painter, const QRect &repaintRegion)
     {
-        Q_UNUSED(repaintRegion)
-
         if (!decoration()) return;
 
+        // button groups paint all their buttons. Skip the ones outside the repainted area
+        const QPointF offset( m_flag == FlagFirstInList ? m_offset : QPointF( 0, m_offset.y() ) );
+        if( !geometry().translated( offset ).toAlignedRect().intersects( repaintRegion ) ) return;
+
         painter->save();
 
         // translate from offset
@@ -196,16 +246,62 @@ namespace Arc
             }
 
 
-        } else {
+        } else if( m_animation->state() == QAbstractAnimation::Running ) {
 
+            // colors change on every animation step, that would only fill the cache
             drawIcon( painter );
 
+        } else {
+
+            // the icon is rendered once per output scale, in device pixels, and
+            // drawn on a device pixel boundary so that it is blitted as is
+            const QPixmap &pixmap( iconPixmap( painter->device()->devicePixelRatioF() ) );
+            const QTransform transform( painter->deviceTransform() );
+            const QPointF position( transform.map( geometry().topLeft() ) );
+            painter->drawPixmap( transform.inverted().map( QPointF( qRound( position.x() ), qRound( position.y() ) ) ), pixmap );
+
         }
 
         painter->restore();
 
     }
 
+    //__________________________________________________________________
+    QPixmap Button::iconPixmap( qreal devicePixelRatio ) const
+    {
+        const QColor background( backgroundColor() );
+        const QColor foreground( foregroundColor() );
+        auto d = qobject_cast<Decoration*>( decoration() );
+
+        int state = 0;
+        if( isPressed() ) state |= IconPressed;
+        if( isHovered() ) state |= IconHovered;
+        if( isChecked() ) state |= IconChecked;
+        if( isCheckedCustom() ) state |= IconCheckedCustom;
+        if( d && d->internalSettings()->auroraeIcons() ) state |= IconAurorae;
+        if( background.isValid() ) state |= IconBackground;
+        if( foreground.isValid() ) state |= IconForeground;
+
+        const IconKey key = {
+            int( type() ), state,
+            background.rgba(), foreground.rgba(), m_buttonHoverBorder.rgba(),
+            m_iconSize.width(), qRound( devicePixelRatio*100 ) };
+
+        if( const QPixmap *pixmap = g_sIcons.get().pixmaps.object( key ) ) return *pixmap;
+
+        QPixmap pixmap( QSize( m_iconSize.width(), m_iconSize.width() )*devicePixelRatio );
+        pixmap.setDevicePixelRatio( devicePixelRatio );
+        pixmap.fill( Qt::transparent );
+
+        QPainter painter( &pixmap );
+        painter.translate( -geometry().topLeft() );
+        drawIcon( &painter );
+        painter.end();
+
+        g_sIcons.get().pixmaps.insert( key, new QPixmap( pixmap ) );
+        return pixmap;
+    }
+
     //__________________________________________________________________
     void Button::drawIcon( QPainter *painter ) const
     {
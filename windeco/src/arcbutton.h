@@ -114,6 +114,9 @@ namespace Arc
         //* draw button icon
         void drawIcon( QPainter *) const;
 
+        //* button icon, rendered at given device pixel ratio. Icons are cached and shared by all buttons
+        QPixmap iconPixmap( qreal devicePixelRatio ) const;
+
         //*@name colors
         //@{
         QColor foregroundColor() const;
@@ -23,25 +23,27 @@
 #include "arcdecoration.h"
 
 #include "arc.h"
+#include "arcapplicationdata.h"
 #include "arcsettingsprovider.h"
+#include "arcshadowprovider.h"
 #include "config-arc.h"
 #include "config/arcconfigwidget.h"
 
 #include "arcbutton.h"
 
-#include "breezeboxshadowrenderer.h"
-
 #include <KDecoration2/DecoratedClient>
 #include <KDecoration2/DecorationButtonGroup>
 #include <KDecoration2/DecorationSettings>
-#include <KDecoration2/DecorationShadow>
 
 #include <KConfigGroup>
 #include <KColorUtils>
 #include <KSharedConfig>
 #include <KPluginFactory>
 
+#include <QCache>
 #include <QPainter>
+#include <QPixmap>
+#include <QTextLayout>
 #include <QTextStream>
 #include <QTimer>
 #include <QVariantAnimation>
@@ -60,89 +62,6 @@ K_PLUGIN_FACTORY_WITH_JSON(
     registerPlugin<Arc::ConfigWidget>();
 )
 
-namespace
-{
-    struct ShadowParams {
-        ShadowParams()
-            : offset(QPoint(0, 0))
-            , radius(0)
-            , opacity(0) {}
-
-        ShadowParams(const QPoint &offset, int radius, qreal opacity)
-            : offset(offset)
-            , radius(radius)
-            , opacity(opacity) {}
-
-        QPoint offset;
-        int radius;
-        qreal opacity;
-    };
-
-    struct CompositeShadowParams {
-        CompositeShadowParams() = default;
-
-        CompositeShadowParams(
-                const QPoint &offset,
-                const ShadowParams &shadow1,
-                const ShadowParams &shadow2)
-            : offset(offset)
-            , shadow1(shadow1)
-            , shadow2(shadow2) {}
-
-        bool isNone() const {
-            return qMax(shadow1.radius, shadow2.radius) == 0;
-        }
-
-        QPoint offset;
-        ShadowParams shadow1;
-        ShadowParams shadow2;
-    };
-
-    const CompositeShadowParams s_shadowParams[] = {
-        // None
-        CompositeShadowParams(),
-        // Small
-        CompositeShadowParams(
-            QPoint(0, 4),
-            ShadowParams(QPoint(0, 0), 16, 1),
-            ShadowParams(QPoint(0, -2), 8, 0.4)),
-        // Medium
-        CompositeShadowParams(
-            QPoint(0, 8),
-            ShadowParams(QPoint(0, 0), 32, 0.9),
-            ShadowParams(QPoint(0, -4), 16, 0.3)),
-        // Large
-        CompositeShadowParams(
-            QPoint(0, 12),
-            ShadowParams(QPoint(0, 0), 48, 0.8),
-            ShadowParams(QPoint(0, -6), 24, 0.2)),
-        // Very large
-        CompositeShadowParams(
-            QPoint(0, 16),
-            ShadowParams(QPoint(0, 0), 64, 0.7),
-            ShadowParams(QPoint(0, -8), 32, 0.1)),
-    };
-
-    inline CompositeShadowParams lookupShadowParams(int size)
-    {
-        switch (size) {
-        case Arc::InternalSettings::ShadowNone:
-            return s_shadowParams[0];
-        case Arc::InternalSettings::ShadowSmall:
-            return s_shadowParams[1];
-        case Arc::InternalSettings::ShadowMedium:
-            return s_shadowParams[2];
-        case Arc::InternalSettings::ShadowLarge:
-            return s_shadowParams[3];
-        case Arc::InternalSettings::ShadowVeryLarge:
-            return s_shadowParams[4];
-        default:
-            // Fallback to the Large size.
-            return s_shadowParams[3];
-        }
-    }
-}
-
 namespace Arc
 {
 
@@ -158,30 +77,58 @@ namespace Arc
     static const QColor DARK_WINDOW_MAIN_BORDER = QColor { "#1d2027" };
     static const QColor DARK_WINDOW_HIGHLIGHT = QColor { "#363b48" };
 
-    //________________________________________________________________
-    static int g_sDecoCount = 0;
-    static int g_shadowSizeEnum = InternalSettings::ShadowLarge;
-    static int g_shadowStrength = 255;
-    static QColor g_shadowColor = Qt::black;
-    static QSharedPointer<KDecoration2::DecorationShadow> g_sShadow;
+    //* width of the title bar frame corners, that cover the rounded corners and their smoothing arcs
+    static const int TITLEBAR_FRAME_CORNER_WIDTH = 12;
+
+    //* metrics shared by all decorations. Decoration settings are shared too,
+    //* hence these are computed once per font change
+    struct SharedMetrics
+    {
+        //* font the metrics are computed for
+        QFont font;
+
+        //* font height
+        int fontHeight = 0;
+    };
+
+    //* data shared by all decorations
+    struct SharedData
+    {
+        //* title bar frames. Frames are painted with a single pixel
+        //* wide middle, stretched to the actual width
+        QCache<quint64, QPixmap> titleBarFrames{ 32 };
+
+        //* font metrics
+        SharedMetrics metrics;
+    };
+
+    static ApplicationData<SharedData> g_sSharedData;
+
+    //* metrics matching given settings
+    static const SharedMetrics &sharedMetrics( const KDecoration2::DecorationSettings *settings )
+    {
+        SharedMetrics &metrics( g_sSharedData.get().metrics );
+        if( settings->font() != metrics.font )
+        {
+            metrics.font = settings->font();
+            metrics.fontHeight = QFontMetrics( metrics.font ).height();
+        }
+
+        return metrics;
+    }
 
     //________________________________________________________________
     Decoration::Decoration(QObject *parent, const QVariantList &args)
         : KDecoration2::Decoration(parent, args)
         , m_animation( new QVariantAnimation( this ) )
-    {
-        g_sDecoCount++;
-    }
+        , m_titleUpdateTimer( new QTimer( this ) )
+    {}
 
     //________________________________________________________________
     Decoration::~Decoration()
     {
-        g_sDecoCount--;
-        if (g_sDecoCount == 0) {
-            // last deco destroyed, clean up shadow
-            g_sShadow.clear();
-        }
-
+        // release the shadow, once the last decoration using it is gone
+        if( m_devicePixelRatio > 0 ) ShadowProvider::self()->unref( m_devicePixelRatio );
     }
 
     //________________________________________________________________
@@ -189,7 +136,10 @@ namespace Arc
     {
         if( m_opacity == value ) return;
         m_opacity = value;
-        update();
+
+        // only the caption and the menu icon follow the animation
+        update( m_captionLayout.valid ? m_captionLayout.rect : titleBar() );
+        updateMenuButtons();
     }
 
     //________________________________________________________________
@@ -244,43 +194,55 @@ namespace Arc
         reconfigure();
         updateTitleBar();
         auto s = settings();
-        connect(s.data(), &KDecoration2::DecorationSettings::borderSizeChanged, this, &Decoration::recalculateBorders);
 
-        // a change in font might cause the borders to change
-        connect(s.data(), &KDecoration2::DecorationSettings::fontChanged, this, &Decoration::recalculateBorders);
-        connect(s.data(), &KDecoration2::DecorationSettings::spacingChanged, this, &Decoration::recalculateBorders);
+        // geometry changes are collected, and laid out once the event loop is back.
+        // A change in font or spacing might cause the borders to change
+        connect(s.data(), &KDecoration2::DecorationSettings::borderSizeChanged, this, [this]() { scheduleLayout( LayoutBorders ); });
+        connect(s.data(), &KDecoration2::DecorationSettings::fontChanged, this, [this]() { scheduleLayout( LayoutBorders|LayoutCaption ); });
+        connect(s.data(), &KDecoration2::DecorationSettings::spacingChanged, this, [this]() { scheduleLayout( LayoutBorders ); });
 
         // buttons
-        connect(s.data(), &KDecoration2::DecorationSettings::spacingChanged, this, &Decoration::updateButtonsGeometryDelayed);
-        connect(s.data(), &KDecoration2::DecorationSettings::decorationButtonsLeftChanged, this, &Decoration::updateButtonsGeometryDelayed);
-        connect(s.data(), &KDecoration2::DecorationSettings::decorationButtonsRightChanged, this, &Decoration::updateButtonsGeometryDelayed);
+        connect(s.data(), &KDecoration2::DecorationSettings::decorationButtonsLeftChanged, this, [this]() { scheduleLayout( LayoutButtons ); });
+        connect(s.data(), &KDecoration2::DecorationSettings::decorationButtonsRightChanged, this, [this]() { scheduleLayout( LayoutButtons ); });
 
         // full reconfiguration
         connect(s.data(), &KDecoration2::DecorationSettings::reconfigured, this, &Decoration::reconfigure);
         connect(s.data(), &KDecoration2::DecorationSettings::reconfigured, SettingsProvider::self(), &SettingsProvider::reconfigure, Qt::UniqueConnection );
-        connect(s.data(), &KDecoration2::DecorationSettings::reconfigured, this, &Decoration::updateButtonsGeometryDelayed);
-
-        connect(c, &KDecoration2::DecoratedClient::adjacentScreenEdgesChanged, this, &Decoration::recalculateBorders);
-        connect(c, &KDecoration2::DecoratedClient::maximizedHorizontallyChanged, this, &Decoration::recalculateBorders);
-        connect(c, &KDecoration2::DecoratedClient::maximizedVerticallyChanged, this, &Decoration::recalculateBorders);
-        connect(c, &KDecoration2::DecoratedClient::shadedChanged, this, &Decoration::recalculateBorders);
+        connect(s.data(), &KDecoration2::DecorationSettings::reconfigured, this, [this]() { scheduleLayout( LayoutButtons ); });
+
+        connect(c, &KDecoration2::DecoratedClient::adjacentScreenEdgesChanged, this, [this]() { scheduleLayout( LayoutBorders ); });
+        connect(c, &KDecoration2::DecoratedClient::maximizedHorizontallyChanged, this, [this]() { scheduleLayout( LayoutBorders ); });
+        connect(c, &KDecoration2::DecoratedClient::maximizedVerticallyChanged, this, [this]() { scheduleLayout( LayoutBorders ); });
+        connect(c, &KDecoration2::DecoratedClient::shadedChanged, this, [this]() { scheduleLayout( LayoutBorders ); });
+        connect(c, &KDecoration2::DecoratedClient::widthChanged, this, [this]() { scheduleLayout( LayoutWidth ); });
+        connect(c, &KDecoration2::DecoratedClient::maximizedChanged, this, [this]() { scheduleLayout( LayoutTitleBar|LayoutButtons ); });
+
+        // caption and icon changes are collapsed, and repainted at most once per interval
+        m_titleUpdateTimer->setSingleShot( true );
+        connect(m_titleUpdateTimer, &QTimer::timeout, this, &Decoration::updateTitle);
         connect(c, &KDecoration2::DecoratedClient::captionChanged, this,
             [this]()
             {
-                // update the caption area
-                update(titleBar());
+                m_captionChanged = true;
+                if( !m_titleUpdateTimer->isActive() ) m_titleUpdateTimer->start();
+            }
+        );
+
+        connect(c, &KDecoration2::DecoratedClient::iconChanged, this,
+            [this]()
+            {
+                m_iconChanged = true;
+                if( !m_titleUpdateTimer->isActive() ) m_titleUpdateTimer->start();
             }
         );
 
         connect(c, &KDecoration2::DecoratedClient::activeChanged, this, &Decoration::updateAnimationState);
-        connect(c, &KDecoration2::DecoratedClient::widthChanged, this, &Decoration::updateTitleBar);
-        connect(c, &KDecoration2::DecoratedClient::maximizedChanged, this, &Decoration::updateTitleBar);
-        connect(c, &KDecoration2::DecoratedClient::maximizedChanged, this, &Decoration::setOpaque);
+        connect(c, &KDecoration2::DecoratedClient::activeChanged, this, &Decoration::updateShadow);
+        connect(c, &KDecoration2::DecoratedClient::maximizedChanged, this, &Decoration::updateMaximizedState);
+        connect(c, &KDecoration2::DecoratedClient::adjacentScreenEdgesChanged, this, &Decoration::updateShadow);
 
-        connect(c, &KDecoration2::DecoratedClient::widthChanged, this, &Decoration::updateButtonsGeometry);
-        connect(c, &KDecoration2::DecoratedClient::maximizedChanged, this, &Decoration::updateButtonsGeometry);
-        connect(c, &KDecoration2::DecoratedClient::adjacentScreenEdgesChanged, this, &Decoration::updateButtonsGeometry);
-        connect(c, &KDecoration2::DecoratedClient::shadedChanged, this, &Decoration::updateButtonsGeometry);
+        // shadow
+        connect(ShadowProvider::self(), &ShadowProvider::shadowChanged, this, &Decoration::updateShadow);
 
         createButtons();
         createShadow();
@@ -299,12 +261,47 @@ namespace Arc
         setTitleBar(QRect(x, y, width, height));
     }
 
+    //________________________________________________________________
+    void Decoration::updateTitle()
+    {
+        if( m_iconChanged )
+        {
+            m_iconChanged = false;
+            updateMenuButtons();
+        }
+
+        // repaint the caption only if the visible, elided, text changed
+        if( m_captionChanged )
+        {
+            m_captionChanged = false;
+            const QString oldText( m_captionLayout.text.text() );
+            const QRect oldRect( m_captionLayout.rect );
+
+            invalidateCaption();
+            if( hideTitleBar() ) return;
+
+            const CaptionLayout &layout( captionLayout() );
+            if( layout.text.text() != oldText || layout.rect != oldRect ) update( oldRect | layout.rect );
+        }
+    }
+
+    //________________________________________________________________
+    void Decoration::updateMenuButtons()
+    {
+        // only the menu button shows the icon
+        foreach( const QPointer<KDecoration2::DecorationButton>& button, m_leftButtons->buttons() + m_rightButtons->buttons() )
+        { if( button && button->type() == KDecoration2::DecorationButtonType::Menu ) button->update(); }
+    }
+
     //________________________________________________________________
     void Decoration::updateAnimationState()
     {
         if( m_internalSettings->animationsEnabled() )
         {
 
+            // buttons switch colors at once. Animation steps only repaint the caption
+            update();
+
             const auto clientPtr = client().toStrongRef();
             m_animation->setDirection( (!clientPtr.isNull() && clientPtr.data()->isActive()) ? QAbstractAnimation::Forward : QAbstractAnimation::Backward );
             if( m_animation->state() != QAbstractAnimation::Running ) m_animation->start();
@@ -362,6 +359,7 @@ namespace Arc
 
         // animation
         m_animation->setDuration( m_internalSettings->animationsDuration() );
+        m_titleUpdateTimer->setInterval( m_internalSettings->titleUpdateInterval() );
 
         // borders
         recalculateBorders();
@@ -369,6 +367,12 @@ namespace Arc
         // shadow
         createShadow();
 
+        // maximized mode
+        setOpaque( isMaximized() );
+
+        // title alignment
+        invalidateCaption();
+
     }
 
     //________________________________________________________________
@@ -387,8 +391,7 @@ namespace Arc
             if( hideTitleBar() ) top = bottom;
             else {
 
-                QFontMetrics fm(s->font());
-                top += qMax(fm.height(), buttonHeight() );
+                top += qMax( sharedMetrics( s.data() ).fontHeight, buttonHeight() );
 
                 // padding below
                 // extra pixel is used for the active window outline
@@ -425,8 +428,70 @@ namespace Arc
     }
 
     //________________________________________________________________
-    void Decoration::updateButtonsGeometryDelayed()
-    { QTimer::singleShot( 0, this, &Decoration::updateButtonsGeometry ); }
+    void Decoration::scheduleLayout( int flags )
+    {
+        if( !m_dirtyLayout ) QTimer::singleShot( 0, this, &Decoration::updateLayout );
+        m_dirtyLayout |= flags;
+    }
+
+    //________________________________________________________________
+    void Decoration::updateLayout()
+    {
+        int flags = m_dirtyLayout;
+        m_dirtyLayout = 0;
+
+        // when only the width changed, as during an interactive resize, right
+        // aligned elements are moved. Otherwise title bar and buttons are laid out again
+        if( flags == LayoutWidth && m_layoutWidth > 0 )
+        {
+            updateWidth();
+            return;
+        }
+
+        if( flags & LayoutWidth ) flags |= LayoutTitleBar|LayoutButtons;
+
+        // the title bar and buttons depend on the top border
+        if( flags & LayoutBorders ) recalculateBorders();
+        if( flags & ( LayoutBorders|LayoutTitleBar ) ) updateTitleBar();
+
+        // laying out buttons invalidates the caption, and repaints
+        if( flags & ( LayoutBorders|LayoutButtons ) ) updateButtonsGeometry();
+        else if( flags & LayoutCaption )
+        {
+            invalidateCaption();
+            update( titleBar() );
+        }
+    }
+
+    //________________________________________________________________
+    void Decoration::updateWidth()
+    {
+        const int oldWidth = m_layoutWidth;
+        const int width = size().width();
+        if( width == oldWidth ) return;
+        m_layoutWidth = width;
+
+        updateTitleBar();
+
+        // right buttons keep their distance to the right edge
+        int rightWidth = borderRight() + TITLEBAR_FRAME_CORNER_WIDTH;
+        if( !m_rightButtons->buttons().isEmpty() )
+        {
+            const QPointF position( m_rightButtons->geometry().topLeft() );
+            m_rightButtons->setPos( QPointF( position.x() + width - oldWidth, position.y() ) );
+            rightWidth += m_rightButtons->geometry().width() + settings()->smallSpacing()*Metrics::TitleBar_SideMargin;
+        }
+
+        const QRect oldCaptionRect( m_captionLayout.valid ? m_captionLayout.rect : titleBar() );
+        invalidateCaption();
+        const QRect captionRect( hideTitleBar() ? QRect() : captionLayout().rect );
+
+        // repaint the right part, from the right buttons to the right border, that moved,
+        // and the caption. The rest of the decoration is unchanged
+        const int left = qMin( oldWidth, width ) - rightWidth;
+        update( QRect( left, 0, width - left, size().height() ) );
+        update( oldCaptionRect | captionRect );
+    }
 
     //________________________________________________________________
     void Decoration::updateButtonsGeometry()
@@ -491,6 +556,8 @@ namespace Arc
 
         }
 
+        m_layoutWidth = size().width();
+        invalidateCaption();
         update();
 
     }
@@ -501,10 +568,31 @@ namespace Arc
         auto c = client().toStrongRef().data();
         auto s = settings();
 
-        // paint background
-        if( !c->isShaded() )
+        // the scale of the output is only known while painting. Switch
+        // shadows once done, when the window moved to another screen
+        const qreal devicePixelRatio = painter->device()->devicePixelRatioF();
+        if( devicePixelRatio != m_devicePixelRatio )
+        { QMetaObject::invokeMethod( this, [this, devicePixelRatio]() { setDevicePixelRatio( devicePixelRatio ); }, Qt::QueuedConnection ); }
+
+        // nothing is painted outside the repainted area, that
+        // only covers the changed elements, such as a hovered button
+        painter->setClipRect( repaintRegion, Qt::IntersectClip );
+
+        // maximized windows have no border and no rounded corner: the title bar
+        // covers the whole decoration, with nothing to blend nor antialias
+        if( isMaximized() )
+        {
+            painter->setRenderHint( QPainter::Antialiasing, false );
+            if( hideTitleBar() ) painter->fillRect( rect(), titleBarColor() );
+            else paintTitleBar( painter, repaintRegion );
+            return;
+        }
+
+        // paint background, unless only the title bar is repainted
+        const QRect bordersRect( 0, borderTop(), size().width(), size().height() - borderTop() );
+        if( !c->isShaded() && ( hideTitleBar() || bordersRect.intersects( repaintRegion ) ) )
         {
-            painter->fillRect(rect(), Qt::transparent);
+            painter->fillRect(rect() & repaintRegion, Qt::transparent);
             painter->save();
             painter->setPen(Qt::NoPen);
 
@@ -546,7 +634,7 @@ namespace Arc
 
         if( !hideTitleBar() ) paintTitleBar(painter, repaintRegion);
 
-        if( hasBorders() && !s->isAlphaChannelSupported() )
+        if( hasBorders() && !s->isAlphaChannelSupported() && !rect().adjusted( 1, 1, -1, -1 ).contains( repaintRegion ) )
         {
             painter->save();
             painter->setRenderHint(QPainter::Antialiasing, false);
@@ -562,12 +650,105 @@ namespace Arc
     void Decoration::paintTitleBar(QPainter *painter, const QRect &repaintRegion)
     {
         const auto clientPtr = client().toStrongRef();
-        const bool noBorders = hasNoSideBorders() || hasNoBorders();
         const QRect titleRect(QPoint(0, 0), QSize(size().width(), borderTop()));
 
         if ( !titleRect.intersects(repaintRegion) || clientPtr.isNull() ) return;
 
-        const auto c = clientPtr.data();
+        auto s = settings();
+
+        // the frame is blitted from a cached one, unless too narrow for its corners
+        const qreal devicePixelRatio = painter->device()->devicePixelRatioF();
+        const QPixmap *frame = titleRect.width() > 2*TITLEBAR_FRAME_CORNER_WIDTH ? titleBarFrame( devicePixelRatio ) : nullptr;
+        if( frame )
+        {
+            const int corner = TITLEBAR_FRAME_CORNER_WIDTH;
+            const qreal height = titleRect.height();
+            const qreal sourceCorner = corner*devicePixelRatio;
+            const qreal sourceHeight = frame->height();
+            const qreal sourceWidth = frame->width();
+
+            painter->drawPixmap( QRectF( 0, 0, corner, height ), *frame, QRectF( 0, 0, sourceCorner, sourceHeight ) );
+            painter->drawPixmap( QRectF( corner, 0, titleRect.width() - 2*corner, height ), *frame, QRectF( sourceCorner, 0, sourceWidth - 2*sourceCorner, sourceHeight ) );
+            painter->drawPixmap( QRectF( titleRect.width() - corner, 0, corner, height ), *frame, QRectF( sourceWidth - sourceCorner, 0, sourceCorner, sourceHeight ) );
+
+        } else paintTitleBarFrame( painter, titleRect );
+
+        // draw caption
+        const CaptionLayout &layout( captionLayout() );
+        if( layout.rect.intersects( repaintRegion ) )
+        {
+            // active and inactive font colors only differ by their alpha, hence the caption
+            // is painted once, opaque, and blended with the font color alpha
+            if( layout.pixmap.isNull() || layout.pixmap.devicePixelRatioF() != devicePixelRatio )
+            {
+                QColor color( fontColor() );
+                color.setAlpha( 255 );
+
+                QPixmap pixmap( layout.rect.size()*devicePixelRatio );
+                pixmap.setDevicePixelRatio( devicePixelRatio );
+                pixmap.fill( Qt::transparent );
+
+                QPainter captionPainter( &pixmap );
+                captionPainter.setFont( s->font() );
+                captionPainter.setPen( color );
+                captionPainter.drawStaticText( layout.position - layout.rect.topLeft(), layout.text );
+                captionPainter.end();
+
+                m_captionLayout.pixmap = pixmap;
+            }
+
+            const qreal opacity( painter->opacity() );
+            painter->setOpacity( opacity*fontColor().alphaF() );
+            painter->drawPixmap( layout.rect.topLeft(), layout.pixmap );
+            painter->setOpacity( opacity );
+        }
+
+        // draw all buttons
+        m_leftButtons->paint(painter, repaintRegion);
+        m_rightButtons->paint(painter, repaintRegion);
+    }
+
+    //________________________________________________________________
+    const QPixmap *Decoration::titleBarFrame( qreal devicePixelRatio ) const
+    {
+        const auto clientPtr = client().toStrongRef();
+        if( clientPtr.isNull() ) return nullptr;
+
+        // everything the frame depends on, but its width
+        const int height = borderTop();
+        const quint64 key =
+            quint64( m_internalSettings->arcTheme() ) |
+            quint64( isMaximized() ) << 4 |
+            quint64( clientPtr->isShaded() ) << 5 |
+            quint64( settings()->isAlphaChannelSupported() ) << 6 |
+            quint64( hasNoSideBorders() || hasNoBorders() ) << 7 |
+            quint64( height ) << 8 |
+            quint64( qRound( devicePixelRatio*100 ) ) << 32;
+
+        QCache<quint64, QPixmap> &frames( g_sSharedData.get().titleBarFrames );
+        if( const QPixmap *frame = frames.object( key ) ) return frame;
+
+        // paint with the narrowest middle, that the corners are stretched from
+        const QRect titleRect( 0, 0, 2*TITLEBAR_FRAME_CORNER_WIDTH + 1, height );
+        auto frame = new QPixmap( titleRect.size()*devicePixelRatio );
+        frame->setDevicePixelRatio( devicePixelRatio );
+        frame->fill( Qt::transparent );
+
+        // same hints as the decoration painter, see paint()
+        QPainter painter( frame );
+        painter.setRenderHint( QPainter::Antialiasing, !isMaximized() );
+        paintTitleBarFrame( &painter, titleRect );
+        painter.end();
+
+        frames.insert( key, frame );
+        return frame;
+    }
+
+    //________________________________________________________________
+    void Decoration::paintTitleBarFrame(QPainter *painter, const QRect &titleRect) const
+    {
+        const auto c = client().toStrongRef().data();
+        const bool noBorders = hasNoSideBorders() || hasNoBorders();
 
         painter->save();
 
@@ -618,21 +799,10 @@ namespace Arc
         }
 
         painter->restore();
-
-        // draw caption
-        painter->setFont(s->font());
-        painter->setPen( fontColor() );
-        const auto cR = captionRect();
-        const QString caption = painter->fontMetrics().elidedText(c->caption(), Qt::ElideMiddle, cR.first.width());
-        painter->drawText(cR.first, cR.second | Qt::TextSingleLine, caption);
-
-        // draw all buttons
-        m_leftButtons->paint(painter, repaintRegion);
-        m_rightButtons->paint(painter, repaintRegion);
     }
 
     //________________________________________________________________
-    void Decoration::paintTitleBarShading(QPainter *painter, const QRect &titleRect, const bool rounded) {
+    void Decoration::paintTitleBarShading(QPainter *painter, const QRect &titleRect, const bool rounded) const {
 
         painter->setPen( highlightColor() );
         painter->setBrush( Qt::NoBrush );
@@ -649,13 +819,13 @@ namespace Arc
 
 
     //________________________________________________________________
-    void Decoration::smoothenTitleBarCorners(QPainter *painter, const QRect &titleRect, bool bottom) {
+    void Decoration::smoothenTitleBarCorners(QPainter *painter, const QRect &titleRect, bool bottom) const {
 
         QPen pen { titleBarColor(), 1.5 };
         painter->setPen( pen );
         painter->setBrush( Qt::NoBrush );
         painter->setRenderHint( QPainter::Antialiasing, false );
-        painter->setClipRect(titleRect, Qt::ReplaceClip);
+        painter->setClipRect(titleRect, Qt::IntersectClip);
 
         QRect arcSize = titleRect.adjusted(0, 0, 7 - titleRect.width(), 7 - titleRect.height());
 
@@ -722,7 +892,7 @@ namespace Arc
 
                     // full caption rect
                     const QRect fullRect = QRect( 0, yOffset, size().width(), captionHeight() );
-                    QRect boundingRect( settings()->fontMetrics().boundingRect( c->caption()).toRect() );
+                    QRect boundingRect( QPoint( 0, 0 ), QSize( int( std::ceil( captionAdvances( c->caption(), settings()->font() ).width ) ), 0 ) );
 
                     // text bounding rect
                     boundingRect.setTop( yOffset );
@@ -742,87 +912,164 @@ namespace Arc
     }
 
     //________________________________________________________________
-    void Decoration::createShadow()
+    const Decoration::CaptionAdvances &Decoration::captionAdvances( const QString &caption, const QFont &font ) const
     {
-        if (!g_sShadow
-                ||g_shadowSizeEnum != m_internalSettings->shadowSize()
-                || g_shadowStrength != m_internalSettings->shadowStrength()
-                || g_shadowColor != m_internalSettings->shadowColor())
+        CaptionAdvances &advances( m_captionAdvances );
+        if( !advances.offsets.isEmpty() && advances.caption == caption && advances.font == font ) return advances;
+
+        advances.caption = caption;
+        advances.font = font;
+        advances.cursors.clear();
+        advances.offsets.clear();
+        advances.width = 0;
+        advances.monotonic = true;
+
+        // shape the caption once, and keep the offset of every cursor position.
+        // Positions inside a grapheme cannot be cut at
+        QTextLayout layout( caption, font );
+        layout.beginLayout();
+        const QTextLine line( layout.createLine() );
+        layout.endLayout();
+        if( line.isValid() ) advances.width = line.naturalTextWidth();
+
+        for( int position = 0; position <= caption.size(); ++position )
         {
-            g_shadowSizeEnum = m_internalSettings->shadowSize();
-            g_shadowStrength = m_internalSettings->shadowStrength();
-            g_shadowColor = m_internalSettings->shadowColor();
-
-            const CompositeShadowParams params = lookupShadowParams(g_shadowSizeEnum);
-            if (params.isNone()) {
-                g_sShadow.clear();
-                setShadow(g_sShadow);
-                return;
-            }
+            if( !layout.isValidCursorPosition( position ) ) continue;
 
-            auto withOpacity = [](const QColor &color, qreal opacity) -> QColor {
-                QColor c(color);
-                c.setAlphaF(opacity);
-                return c;
-            };
-
-            const QSize boxSize = Breeze::BoxShadowRenderer::calculateMinimumBoxSize(params.shadow1.radius)
-                .expandedTo(Breeze::BoxShadowRenderer::calculateMinimumBoxSize(params.shadow2.radius));
-
-            Breeze::BoxShadowRenderer shadowRenderer;
-            shadowRenderer.setBorderRadius(Metrics::Frame_FrameRadius + 0.5);
-            shadowRenderer.setBoxSize(boxSize);
-
-            const qreal strength = static_cast<qreal>(g_shadowStrength) / 255.0;
-            shadowRenderer.addShadow(params.shadow1.offset, params.shadow1.radius,
-                withOpacity(g_shadowColor, params.shadow1.opacity * strength));
-            shadowRenderer.addShadow(params.shadow2.offset, params.shadow2.radius,
-                withOpacity(g_shadowColor, params.shadow2.opacity * strength));
-
-            QImage shadowTexture = shadowRenderer.render();
-
-            QPainter painter(&shadowTexture);
-            painter.setRenderHint(QPainter::Antialiasing);
-
-            const QRect outerRect = shadowTexture.rect();
-
-            QRect boxRect(QPoint(0, 0), boxSize);
-            boxRect.moveCenter(outerRect.center());
-
-            // Mask out inner rect.
-            const QMargins padding = QMargins(
-                boxRect.left() - outerRect.left() - Metrics::Shadow_Overlap - params.offset.x(),
-                boxRect.top() - outerRect.top() - Metrics::Shadow_Overlap - params.offset.y(),
-                outerRect.right() - boxRect.right() - Metrics::Shadow_Overlap + params.offset.x(),
-                outerRect.bottom() - boxRect.bottom() - Metrics::Shadow_Overlap + params.offset.y());
-            const QRect innerRect = outerRect - padding;
-
-            painter.setPen(Qt::NoPen);
-            painter.setBrush(Qt::black);
-            painter.setCompositionMode(QPainter::CompositionMode_DestinationOut);
-            painter.drawRoundedRect(
-                innerRect,
-                Metrics::Frame_FrameRadius + 0.5,
-                Metrics::Frame_FrameRadius + 0.5);
-
-            // Draw outline.
-            painter.setPen(withOpacity(g_shadowColor, 0.2 * strength));
-            painter.setBrush(Qt::NoBrush);
-            painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-            painter.drawRoundedRect(
-                innerRect,
-                Metrics::Frame_FrameRadius - 0.5,
-                Metrics::Frame_FrameRadius - 0.5);
-
-            painter.end();
-
-            g_sShadow = QSharedPointer<KDecoration2::DecorationShadow>::create();
-            g_sShadow->setPadding(padding);
-            g_sShadow->setInnerShadowRect(QRect(outerRect.center(), QSize(1, 1)));
-            g_sShadow->setShadow(shadowTexture);
+            const qreal offset( line.isValid() ? line.cursorToX( position ) : 0 );
+            if( !advances.offsets.isEmpty() && offset < advances.offsets.last() ) advances.monotonic = false;
+
+            advances.cursors.append( position );
+            advances.offsets.append( offset );
         }
 
-        setShadow(g_sShadow);
+        if( advances.offsets.isEmpty() )
+        {
+            advances.cursors.append( 0 );
+            advances.offsets.append( 0 );
+        }
+
+        advances.ellipsisWidth = QFontMetricsF( font ).horizontalAdvance( QChar( 0x2026 ) );
+        return advances;
+    }
+
+    //________________________________________________________________
+    QString Decoration::elidedCaption( const QString &caption, const QFont &font, int width ) const
+    {
+        // offsets of right to left text do not grow with positions
+        const CaptionAdvances &advances( captionAdvances( caption, font ) );
+        if( !advances.monotonic ) return QFontMetrics( font ).elidedText( caption, Qt::ElideMiddle, width );
+
+        const int count = advances.cursors.size();
+        const qreal total = advances.offsets.last();
+        if( total <= width ) return caption;
+
+        // width of the caption, keeping kept/2 graphemes on the left and the rest on the right,
+        // as ElideMiddle does. It grows with kept, hence the largest kept that fits is searched
+        const qreal available = width - advances.ellipsisWidth;
+        auto keptWidth = [&advances, count, total]( int kept )
+        {
+            const int left = ( kept + 1 )/2;
+            const int right = kept/2;
+            return advances.offsets[left] + total - advances.offsets[count - 1 - right];
+        };
+
+        int low = 0;
+        int high = count - 2;
+        if( available <= 0 ) high = -1;
+        while( low < high )
+        {
+            const int middle = ( low + high + 1 )/2;
+            if( keptWidth( middle ) <= available ) low = middle;
+            else high = middle - 1;
+        }
+
+        if( high < 0 ) return QString();
+
+        const int left = ( low + 1 )/2;
+        const int right = low/2;
+        return caption.left( advances.cursors[left] ) + QChar( 0x2026 ) + caption.mid( advances.cursors[count - 1 - right] );
+    }
+
+    //________________________________________________________________
+    const Decoration::CaptionLayout &Decoration::captionLayout()
+    {
+        if( m_captionLayout.valid ) return m_captionLayout;
+
+        auto c = client().toStrongRef().data();
+        const QFont font( settings()->font() );
+        const auto cR = captionRect();
+
+        m_captionLayout.text.setTextFormat( Qt::PlainText );
+        m_captionLayout.text.setText( elidedCaption( c->caption(), font, cR.first.width() ) );
+        m_captionLayout.text.prepare( QTransform(), font );
+
+        // align the text in the caption rect, the way drawText does
+        const QSizeF textSize( m_captionLayout.text.size() );
+        const QRectF rect( cR.first );
+        qreal x;
+        if( cR.second & Qt::AlignLeft ) x = rect.left();
+        else if( cR.second & Qt::AlignRight ) x = rect.right() + 1 - textSize.width();
+        else x = rect.left() + ( rect.width() - textSize.width() )/2;
+
+        m_captionLayout.position = QPointF( x, rect.top() + ( rect.height() - textSize.height() )/2 );
+        m_captionLayout.rect = QRectF( m_captionLayout.position, textSize ).toAlignedRect();
+        m_captionLayout.pixmap = QPixmap();
+        m_captionLayout.valid = true;
+        return m_captionLayout;
+    }
+
+    //________________________________________________________________
+    void Decoration::createShadow()
+    {
+        // the shadow is rendered asynchronously. The current one is kept
+        // until the new one is ready, then updateShadow is called
+        ShadowProvider::self()->reconfigure( m_internalSettings );
+        updateShadow();
+    }
+
+    //________________________________________________________________
+    void Decoration::updateMaximizedState()
+    {
+        setOpaque( isMaximized() );
+        updateShadow();
+    }
+
+    //________________________________________________________________
+    void Decoration::updateShadow()
+    {
+        // maximized windows have no shadow
+        if( isMaximized() )
+        {
+            setShadow( QSharedPointer<KDecoration2::DecorationShadow>() );
+            return;
+        }
+
+        // no shadow is requested until the first paint tells the scale,
+        // that would render one at the wrong scale otherwise
+        if( m_devicePixelRatio <= 0 ) return;
+
+        const auto c = client().toStrongRef();
+        const bool active = c && c->isActive();
+
+        // keep the current shadow until one matching the new scale is ready
+        if( ShadowProvider::self()->isPending( m_devicePixelRatio, active ) ) return;
+
+        // no shadow is drawn past the screen edges the window is against
+        const Qt::Edges edges = c ? c->adjacentScreenEdges() : Qt::Edges();
+        setShadow( ShadowProvider::self()->shadow( m_devicePixelRatio, active, edges ) );
+    }
+
+    //________________________________________________________________
+    void Decoration::setDevicePixelRatio( qreal value )
+    {
+        if( m_devicePixelRatio == value ) return;
+
+        ShadowProvider::self()->ref( value );
+        if( m_devicePixelRatio > 0 ) ShadowProvider::self()->unref( m_devicePixelRatio );
+        m_devicePixelRatio = value;
+
+        updateShadow();
     }
 
 } // namespace
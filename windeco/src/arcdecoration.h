@@ -30,8 +30,12 @@
 #include <KDecoration2/DecorationSettings>
 
 #include <QPalette>
+#include <QPixmap>
+#include <QStaticText>
 #include <QVariant>
+#include <QVector>
 
+class QTimer;
 class QVariantAnimation;
 
 namespace KDecoration2
@@ -105,21 +109,95 @@ namespace Arc
         void reconfigure();
         void recalculateBorders();
         void updateButtonsGeometry();
-        void updateButtonsGeometryDelayed();
+        void updateLayout();
         void updateTitleBar();
+        void updateTitle();
         void updateAnimationState();
+        void updateShadow();
+        void updateMaximizedState();
+
+        //* caption layout must be computed again
+        void invalidateCaption()
+        { m_captionLayout.valid = false; }
 
         private:
 
+        //* parts of the layout that must be computed again
+        enum LayoutFlag
+        {
+            LayoutBorders = 1<<0,
+            LayoutTitleBar = 1<<1,
+            LayoutButtons = 1<<2,
+            LayoutCaption = 1<<3,
+            LayoutWidth = 1<<4
+        };
+
+        //* lay out given parts once back to the event loop, along with any other
+        //* change in the meantime, so that a single repaint is issued
+        void scheduleLayout( int flags );
+
+        //* width only change, that moves right aligned elements and repaints them
+        void updateWidth();
+
         //* return the rect in which caption will be drawn
         QPair<QRect,Qt::Alignment> captionRect() const;
 
+        //* elided caption, laid out at its final position
+        struct CaptionLayout
+        {
+            bool valid = false;
+            QStaticText text;
+            QPointF position;
+
+            //* area covered by the text
+            QRect rect;
+
+            //* text painted over that area, created on demand
+            QPixmap pixmap;
+        };
+
+        //* cached caption layout. It is computed again only once invalidated
+        const CaptionLayout &captionLayout();
+
+        //* offsets of a caption cursor positions, to elide it without shaping it again
+        struct CaptionAdvances
+        {
+            QString caption;
+            QFont font;
+
+            //* valid cursor positions, and their offsets from the caption start
+            QVector<int> cursors;
+            QVector<qreal> offsets;
+
+            //* natural width of the caption, whatever its direction
+            qreal width = 0;
+
+            qreal ellipsisWidth = 0;
+
+            //* false for right to left text, that is elided the usual way
+            bool monotonic = true;
+        };
+
+        //* advances of given caption, computed again only when caption or font change
+        const CaptionAdvances &captionAdvances( const QString &, const QFont & ) const;
+
+        //* caption elided in the middle to given width. This is logarithmic in the caption length
+        QString elidedCaption( const QString &, const QFont &, int width ) const;
+
         void createButtons();
+        void updateMenuButtons();
         void paintTitleBar(QPainter *painter, const QRect &repaintRegion);
-        void paintTitleBarShading(QPainter *painter, const QRect &titleRect, const bool rounded);
-        void smoothenTitleBarCorners(QPainter *painter, const QRect &titleRect, bool bottom);
+        void paintTitleBarFrame(QPainter *painter, const QRect &titleRect) const;
+        void paintTitleBarShading(QPainter *painter, const QRect &titleRect, const bool rounded) const;
+        void smoothenTitleBarCorners(QPainter *painter, const QRect &titleRect, bool bottom) const;
+
+        //* cached title bar frame, for current state and given device pixel ratio
+        const QPixmap *titleBarFrame( qreal devicePixelRatio ) const;
         void createShadow();
 
+        //* device pixel ratio of the output the decoration is painted on
+        void setDevicePixelRatio( qreal );
+
         //*@name border size
         //@{
         int borderSize() const;
@@ -138,6 +216,30 @@ namespace Arc
         //* active state change opacity
         qreal m_opacity = 0;
 
+        //* collapses caption and icon changes
+        QTimer *m_titleUpdateTimer;
+
+        //*@name changes waiting for the title update timer
+        //@{
+        bool m_captionChanged = false;
+        bool m_iconChanged = false;
+        //@}
+
+        //* device pixel ratio of the output the decoration is painted on, 0 until first painted
+        qreal m_devicePixelRatio = 0;
+
+        //* parts of the layout to compute again in updateLayout
+        int m_dirtyLayout = 0;
+
+        //* width the buttons were last laid out for
+        int m_layoutWidth = 0;
+
+        //* caption layout
+        CaptionLayout m_captionLayout;
+
+        //* caption advances. Mutable, since the caption rect depends on the caption width
+        mutable CaptionAdvances m_captionAdvances;
+
     };
 
     bool Decoration::hasBorders() const
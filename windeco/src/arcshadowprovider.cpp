@@ -0,0 +1,664 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "arcshadowprovider.h"
+
+#include "breezeboxshadowrenderer.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QPainter>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrentRun>
+
+namespace
+{
+    struct ShadowParams {
+        constexpr ShadowParams()
+            : offset(QPoint(0, 0))
+            , radius(0)
+            , opacity(0) {}
+
+        constexpr ShadowParams(const QPoint &offset, int radius, qreal opacity)
+            : offset(offset)
+            , radius(radius)
+            , opacity(opacity) {}
+
+        QPoint offset;
+        int radius;
+        qreal opacity;
+    };
+
+    struct CompositeShadowParams {
+        constexpr CompositeShadowParams() = default;
+
+        constexpr CompositeShadowParams(
+                const QPoint &offset,
+                const ShadowParams &shadow1,
+                const ShadowParams &shadow2)
+            : offset(offset)
+            , shadow1(shadow1)
+            , shadow2(shadow2) {}
+
+        constexpr bool isNone() const {
+            return qMax(shadow1.radius, shadow2.radius) == 0;
+        }
+
+        QPoint offset;
+        ShadowParams shadow1;
+        ShadowParams shadow2;
+    };
+
+    constexpr CompositeShadowParams s_shadowParams[] = {
+        // None
+        CompositeShadowParams(),
+        // Small
+        CompositeShadowParams(
+            QPoint(0, 4),
+            ShadowParams(QPoint(0, 0), 16, 1),
+            ShadowParams(QPoint(0, -2), 8, 0.4)),
+        // Medium
+        CompositeShadowParams(
+            QPoint(0, 8),
+            ShadowParams(QPoint(0, 0), 32, 0.9),
+            ShadowParams(QPoint(0, -4), 16, 0.3)),
+        // Large
+        CompositeShadowParams(
+            QPoint(0, 12),
+            ShadowParams(QPoint(0, 0), 48, 0.8),
+            ShadowParams(QPoint(0, -6), 24, 0.2)),
+        // Very large
+        CompositeShadowParams(
+            QPoint(0, 16),
+            ShadowParams(QPoint(0, 0), 64, 0.7),
+            ShadowParams(QPoint(0, -8), 32, 0.1)),
+    };
+
+    //* geometry of the shadow texture, in logical pixels
+    struct ShadowGeometry {
+        QSize boxSize;
+        QSize textureSize;
+        QMargins padding;
+    };
+
+    constexpr ShadowGeometry computeShadowGeometry(const CompositeShadowParams &params)
+    {
+        using Breeze::BoxShadowRenderer;
+
+        const QSize box1 = BoxShadowRenderer::calculateMinimumBoxSize(params.shadow1.radius);
+        const QSize box2 = BoxShadowRenderer::calculateMinimumBoxSize(params.shadow2.radius);
+        const QSize boxSize(qMax(box1.width(), box2.width()), qMax(box1.height(), box2.height()));
+
+        const QSize texture1 = BoxShadowRenderer::calculateMinimumShadowTextureSize(boxSize, params.shadow1.radius, params.shadow1.offset);
+        const QSize texture2 = BoxShadowRenderer::calculateMinimumShadowTextureSize(boxSize, params.shadow2.radius, params.shadow2.offset);
+        const QSize textureSize(qMax(texture1.width(), texture2.width()), qMax(texture1.height(), texture2.height()));
+
+        // box centered in the texture, the way QRect::moveCenter does
+        const int boxLeft = (textureSize.width() - 1)/2 - (boxSize.width() - 1)/2;
+        const int boxTop = (textureSize.height() - 1)/2 - (boxSize.height() - 1)/2;
+        const int boxRight = boxLeft + boxSize.width() - 1;
+        const int boxBottom = boxTop + boxSize.height() - 1;
+
+        const QMargins padding(
+            boxLeft - Arc::Metrics::Shadow_Overlap - params.offset.x(),
+            boxTop - Arc::Metrics::Shadow_Overlap - params.offset.y(),
+            textureSize.width() - 1 - boxRight - Arc::Metrics::Shadow_Overlap + params.offset.x(),
+            textureSize.height() - 1 - boxBottom - Arc::Metrics::Shadow_Overlap + params.offset.y());
+
+        return { boxSize, textureSize, padding };
+    }
+
+    constexpr ShadowGeometry s_shadowGeometry[] = {
+        computeShadowGeometry(s_shadowParams[0]),
+        computeShadowGeometry(s_shadowParams[1]),
+        computeShadowGeometry(s_shadowParams[2]),
+        computeShadowGeometry(s_shadowParams[3]),
+        computeShadowGeometry(s_shadowParams[4]),
+    };
+
+    // pin the geometry of the small shadow, the default
+    static_assert(s_shadowGeometry[1].boxSize.width() == 47 && s_shadowGeometry[1].textureSize.width() == 93, "small shadow size");
+    static_assert(s_shadowGeometry[1].padding.left() == 20 && s_shadowGeometry[1].padding.top() == 16
+        && s_shadowGeometry[1].padding.right() == 20 && s_shadowGeometry[1].padding.bottom() == 24, "small shadow padding");
+    static_assert(s_shadowGeometry[4].textureSize.width() == 361, "very large shadow size");
+
+    constexpr int shadowPresetIndex(int size)
+    {
+        switch (size) {
+        case Arc::InternalSettings::ShadowNone:
+            return 0;
+        case Arc::InternalSettings::ShadowSmall:
+            return 1;
+        case Arc::InternalSettings::ShadowMedium:
+            return 2;
+        case Arc::InternalSettings::ShadowLarge:
+            return 3;
+        case Arc::InternalSettings::ShadowVeryLarge:
+            return 4;
+        default:
+            // Fallback to the Large size.
+            return 3;
+        }
+    }
+
+    //*@name custom shadows
+    //@{
+
+    //* radius and offset steps. Custom shadows are rounded to these, so that
+    //* nearby settings share a texture
+    const int s_shadowRadiusStep = 4;
+    const int s_shadowOffsetStep = 2;
+
+    inline int quantise(int value, int step)
+    { return (value + step/2)/step*step; }
+
+    //* parameters of a custom shadow, interpolated from the presets,
+    //* which all follow the same rule
+    CompositeShadowParams customShadowParams(int radius, int offset)
+    {
+        return CompositeShadowParams(
+            QPoint(0, offset),
+            ShadowParams(QPoint(0, 0), radius, qMin(1.0, 1.1 - radius/160.0)),
+            ShadowParams(QPoint(0, -offset/2), radius/2, qMax(0.05, 0.5 - radius/160.0)));
+    }
+
+    //@}
+
+    inline CompositeShadowParams lookupShadowParams(const Arc::ShadowKey &key)
+    {
+        return key.size == Arc::InternalSettings::ShadowCustom
+            ? customShadowParams(key.radius, key.offset)
+            : s_shadowParams[shadowPresetIndex(key.size)];
+    }
+
+    inline ShadowGeometry lookupShadowGeometry(const Arc::ShadowKey &key)
+    {
+        return key.size == Arc::InternalSettings::ShadowCustom
+            ? computeShadowGeometry(customShadowParams(key.radius, key.offset))
+            : s_shadowGeometry[shadowPresetIndex(key.size)];
+    }
+
+    //* memory used by a texture, in kilobytes, as cost in the texture cache
+    inline int shadowTextureCost(const Arc::ShadowTexture &texture)
+    { return qMax<int>(1, texture.image.sizeInBytes()/1024); }
+
+    //* version of the rendered textures. Bump it whenever rendering changes, to invalidate the disk cache
+    const quint32 s_shadowCacheVersion = 5;
+
+    //* delay before releasing shadows no decoration uses, in milliseconds
+    const int s_shadowReleaseDelay = 30000;
+
+    //* magic number at the start of disk cache files
+    const quint32 s_shadowCacheMagic = 0x53435241;
+
+    //* disk cache file header. Pixels follow, aligned to the header size
+    struct ShadowCacheHeader {
+        quint32 magic;
+        quint32 version;
+        qint32 width;
+        qint32 height;
+        qint32 bytesPerLine;
+        qint32 padding[4];
+        qint32 innerShadowRect[4];
+        qint32 reserved[3];
+    };
+
+    //* number of disk cache files kept, the most recently used ones. That covers
+    //* both shadows of every preset at a few scales, and some custom ones
+    const int s_shadowCacheMaxFiles = 64;
+
+    //* path of the disk cache directory
+    QString shadowCacheDirectory()
+    { return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/arcdecoration"); }
+
+    //* path of the disk cache file for given key
+    QString shadowCacheFileName(const Arc::ShadowKey &key, qreal devicePixelRatio)
+    {
+        return QStringLiteral("%1/shadow-v%2-%3-%4-%5-%6-%7-r%8-s%9.bin")
+            .arg(shadowCacheDirectory())
+            .arg(s_shadowCacheVersion)
+            .arg(key.size)
+            .arg(key.radius)
+            .arg(key.offset)
+            .arg(key.strength)
+            .arg(key.color.rgba(), 8, 16, QLatin1Char('0'))
+            .arg(Arc::Metrics::Frame_FrameRadius)
+            .arg(qRound(devicePixelRatio * 100));
+    }
+
+    //* release a memory mapped disk cache file
+    void unmapShadowCacheFile(void *file)
+    { delete static_cast<QFile *>(file); }
+}
+
+namespace Arc
+{
+
+    static ApplicationData<ShadowProvider> g_sShadowProvider;
+
+    //__________________________________________________________________
+    ShadowProvider::ShadowProvider()
+    {
+        // a few very large textures at most, or many small ones
+        m_textures.setMaxCost( 16*1024 );
+
+        m_releaseTimer.setSingleShot( true );
+        m_releaseTimer.setInterval( s_shadowReleaseDelay );
+        connect( &m_releaseTimer, &QTimer::timeout, this, &ShadowProvider::releaseUnused );
+
+        // listing and deleting files may be slow, hence is kept off the main thread
+        m_pruning = QtConcurrent::run( &ShadowProvider::pruneCachedTextures );
+    }
+
+    //__________________________________________________________________
+    ShadowProvider::~ShadowProvider()
+    {
+        m_releaseTimer.stop();
+
+        // workers run code of the plugin, hence must be done before it is unloaded.
+        // Started renders cannot be canceled, and are short, so they are waited for
+        m_pruning.waitForFinished();
+        for( QFutureWatcherBase *watcher : findChildren<QFutureWatcherBase *>() )
+        { watcher->waitForFinished(); }
+    }
+
+    //__________________________________________________________________
+    ShadowProvider *ShadowProvider::self()
+    { return &g_sShadowProvider.get(); }
+
+    //__________________________________________________________________
+    QSharedPointer<KDecoration2::DecorationShadow> ShadowProvider::shadow( qreal devicePixelRatio, bool active, Qt::Edges edges )
+    {
+        auto iter = m_shadows.find( scaleKey( devicePixelRatio ) );
+        if( iter == m_shadows.end() ) return QSharedPointer<KDecoration2::DecorationShadow>();
+
+        ShadowState &state = iter->states[stateIndex( active )];
+        if( !state.shadow || !edges ) return state.shadow;
+
+        auto &cropped = state.croppedShadows[int( edges )];
+        if( !cropped ) cropped = cropShadow( state.shadow, edges );
+        return cropped;
+    }
+
+    //__________________________________________________________________
+    ShadowKey ShadowProvider::shadowKey( const InternalSettingsPtr &internalSettings, int size )
+    {
+        ShadowKey key;
+        key.size = size;
+        key.strength = internalSettings->shadowStrength();
+        key.color = internalSettings->shadowColor();
+
+        if( size == InternalSettings::ShadowCustom )
+        {
+            key.radius = qMax( s_shadowRadiusStep, quantise( internalSettings->shadowRadius(), s_shadowRadiusStep ) );
+
+            // larger offsets would move the shadow off its texture
+            key.offset = qMin( key.radius/2, quantise( internalSettings->shadowOffset(), s_shadowOffsetStep ) );
+        }
+
+        return key;
+    }
+
+    //__________________________________________________________________
+    void ShadowProvider::reconfigure( const InternalSettingsPtr &internalSettings )
+    {
+        const ShadowKey activeKey( shadowKey( internalSettings, internalSettings->shadowSize() ) );
+        const int inactiveSize( internalSettings->inactiveShadowSize() < 0 ? internalSettings->shadowSize() : internalSettings->inactiveShadowSize() );
+        const ShadowKey inactiveKey( shadowKey( internalSettings, inactiveSize ) );
+
+        const bool activeChanged = !m_configured || activeKey != m_keys[0];
+        const bool inactiveChanged = !m_configured || inactiveKey != m_keys[1];
+        if( !activeChanged && !inactiveChanged ) return;
+
+        const bool wasShared = m_keys[1] == m_keys[0];
+        m_keys[0] = activeKey;
+        m_keys[1] = inactiveKey;
+        m_configured = true;
+
+        const auto scales = m_shadows.keys();
+        for( int scale : scales )
+        {
+            if( activeChanged ) requestShadow( scale, 0 );
+
+            // the inactive state is only used when both shadows differ
+            if( stateIndex( false ) == 0 ) m_shadows[scale].states[1] = ShadowState();
+            else if( inactiveChanged || wasShared ) requestShadow( scale, 1 );
+        }
+    }
+
+    //__________________________________________________________________
+    void ShadowProvider::ref( qreal devicePixelRatio )
+    {
+        const int scale = scaleKey( devicePixelRatio );
+        ScaledShadow &entry = m_shadows[scale];
+
+        // scales not seen yet are rendered lazily. Released ones are still
+        // up to date, since reconfigure covers them
+        const bool isNew( entry.states[0].generation == 0 );
+        if( ++entry.refCount == 1 && isNew && m_configured )
+        {
+            requestShadow( scale, 0 );
+            if( stateIndex( false ) == 1 ) requestShadow( scale, 1 );
+        }
+    }
+
+    //__________________________________________________________________
+    void ShadowProvider::unref( qreal devicePixelRatio )
+    {
+        const int scale = scaleKey( devicePixelRatio );
+        auto iter = m_shadows.find( scale );
+        if( iter == m_shadows.end() ) return;
+
+        if( --iter->refCount <= 0 )
+        {
+            iter->refCount = 0;
+            m_releaseTimer.start();
+        }
+    }
+
+    //__________________________________________________________________
+    void ShadowProvider::releaseUnused()
+    {
+        for( auto iter = m_shadows.begin(); iter != m_shadows.end(); )
+        {
+            if( iter->refCount == 0 ) iter = m_shadows.erase( iter );
+            else ++iter;
+        }
+
+        // with no decoration left, recently used textures go too
+        if( m_shadows.isEmpty() ) m_textures.clear();
+    }
+
+    //__________________________________________________________________
+    void ShadowProvider::requestShadow( int scale, int index )
+    {
+        const ShadowKey key( m_keys[index] );
+        ShadowState &state = m_shadows[scale].states[index];
+        const int generation = state.generation = ++m_generation;
+
+        if( lookupShadowParams( key ).isNone() )
+        {
+            state.shadow.clear();
+            state.croppedShadows.clear();
+            state.pending = false;
+            emit shadowChanged();
+            return;
+        }
+
+        // recently used textures are reused as is
+        const QPair<ShadowKey, int> textureKey( key, scale );
+        if( const ShadowTexture *cached = m_textures.object( textureKey ) )
+        {
+            setShadow( scale, index, *cached );
+            return;
+        }
+
+        // so are textures rendered by a previous session
+        const qreal devicePixelRatio = scale/100.0;
+        ShadowTexture texture;
+        if( loadCachedTexture( key, devicePixelRatio, texture ) )
+        {
+            m_textures.insert( textureKey, new ShadowTexture( texture ), shadowTextureCost( texture ) );
+            setShadow( scale, index, texture );
+            return;
+        }
+
+        // render in a worker thread, and swap the shadow once done,
+        // unless another request came in, or the scale was released, in the meantime
+        state.pending = true;
+        auto watcher = new QFutureWatcher<ShadowTexture>( this );
+        connect( watcher, &QFutureWatcherBase::finished, this, [this, watcher, textureKey, scale, index, generation]()
+            {
+                watcher->deleteLater();
+
+                // outdated renders are kept too, for when settings go back to them
+                const ShadowTexture &texture( watcher->result() );
+                m_textures.insert( textureKey, new ShadowTexture( texture ), shadowTextureCost( texture ) );
+
+                const auto iter = m_shadows.constFind( scale );
+                if( iter != m_shadows.constEnd() && iter->states[index].generation == generation )
+                { setShadow( scale, index, texture ); }
+            }
+        );
+
+        watcher->setFuture( QtConcurrent::run( []( const ShadowKey &key, qreal devicePixelRatio )
+            {
+                const ShadowTexture texture = render( key, devicePixelRatio );
+                saveCachedTexture( key, devicePixelRatio, texture );
+                return texture;
+            }, key, devicePixelRatio ) );
+    }
+
+    //__________________________________________________________________
+    void ShadowProvider::setShadow( int scale, int index, const ShadowTexture &texture )
+    {
+        auto shadow = QSharedPointer<KDecoration2::DecorationShadow>::create();
+        shadow->setPadding(texture.padding);
+        shadow->setInnerShadowRect(texture.innerShadowRect);
+        shadow->setShadow(texture.image);
+
+        ShadowState &state = m_shadows[scale].states[index];
+        state.shadow = shadow;
+        state.croppedShadows.clear();
+        state.pending = false;
+        emit shadowChanged();
+    }
+
+    //__________________________________________________________________
+    QSharedPointer<KDecoration2::DecorationShadow> ShadowProvider::cropShadow( const QSharedPointer<KDecoration2::DecorationShadow> &shadow, Qt::Edges edges )
+    {
+        // drop the texture up to the inner shadow rect on cropped edges, so that
+        // the compositor has no quads to draw there. All in image pixels
+        const QImage image( shadow->shadow() );
+        const QRect innerShadowRect( shadow->innerShadowRect() );
+        QRect cropRect( image.rect() );
+        QMargins padding( shadow->padding() );
+
+        if( edges & Qt::LeftEdge )
+        {
+            cropRect.setLeft( innerShadowRect.left() );
+            padding.setLeft( 0 );
+        }
+
+        if( edges & Qt::TopEdge )
+        {
+            cropRect.setTop( innerShadowRect.top() );
+            padding.setTop( 0 );
+        }
+
+        if( edges & Qt::RightEdge )
+        {
+            cropRect.setRight( innerShadowRect.right() );
+            padding.setRight( 0 );
+        }
+
+        if( edges & Qt::BottomEdge )
+        {
+            cropRect.setBottom( innerShadowRect.bottom() );
+            padding.setBottom( 0 );
+        }
+
+        auto cropped = QSharedPointer<KDecoration2::DecorationShadow>::create();
+        cropped->setPadding( padding );
+        cropped->setInnerShadowRect( innerShadowRect.translated( -cropRect.topLeft() ) );
+        cropped->setShadow( image.copy( cropRect ) );
+        return cropped;
+    }
+
+    //__________________________________________________________________
+    bool ShadowProvider::loadCachedTexture( const ShadowKey &key, qreal devicePixelRatio, ShadowTexture &texture )
+    {
+        QScopedPointer<QFile> file( new QFile( shadowCacheFileName( key, devicePixelRatio ) ) );
+        if( !file->open( QIODevice::ReadOnly ) ) return false;
+
+        const qint64 size = file->size();
+        if( size < qint64( sizeof( ShadowCacheHeader ) ) ) return false;
+
+        const uchar *data = file->map( 0, size );
+        if( !data ) return false;
+
+        // anything unexpected means a corrupt or outdated file, that is rendered again
+        const auto header = reinterpret_cast<const ShadowCacheHeader *>( data );
+        if( header->magic != s_shadowCacheMagic || header->version != s_shadowCacheVersion ) return false;
+        if( header->width <= 0 || header->height <= 0 || header->bytesPerLine < header->width * 4 ) return false;
+        if( size != qint64( sizeof( ShadowCacheHeader ) ) + qint64( header->bytesPerLine ) * header->height ) return false;
+
+        // the modification time tells the most recently used files, when pruning
+        file->setFileTime( QDateTime::currentDateTime(), QFileDevice::FileModificationTime );
+
+        // the image keeps the file mapped for as long as it is used
+        QFile *mappedFile = file.take();
+        texture.image = QImage(
+            data + sizeof( ShadowCacheHeader ), header->width, header->height, header->bytesPerLine,
+            QImage::Format_ARGB32_Premultiplied, unmapShadowCacheFile, mappedFile );
+        texture.image.setDevicePixelRatio( devicePixelRatio );
+        texture.padding = QMargins( header->padding[0], header->padding[1], header->padding[2], header->padding[3] );
+        texture.innerShadowRect = QRect( header->innerShadowRect[0], header->innerShadowRect[1], header->innerShadowRect[2], header->innerShadowRect[3] );
+        return true;
+    }
+
+    //__________________________________________________________________
+    void ShadowProvider::saveCachedTexture( const ShadowKey &key, qreal devicePixelRatio, const ShadowTexture &texture )
+    {
+        const QString fileName( shadowCacheFileName( key, devicePixelRatio ) );
+        if( !QDir().mkpath( QFileInfo( fileName ).absolutePath() ) ) return;
+
+        const QImage &image( texture.image );
+
+        ShadowCacheHeader header = {};
+        header.magic = s_shadowCacheMagic;
+        header.version = s_shadowCacheVersion;
+        header.width = image.width();
+        header.height = image.height();
+        header.bytesPerLine = image.bytesPerLine();
+        header.padding[0] = texture.padding.left();
+        header.padding[1] = texture.padding.top();
+        header.padding[2] = texture.padding.right();
+        header.padding[3] = texture.padding.bottom();
+        header.innerShadowRect[0] = texture.innerShadowRect.x();
+        header.innerShadowRect[1] = texture.innerShadowRect.y();
+        header.innerShadowRect[2] = texture.innerShadowRect.width();
+        header.innerShadowRect[3] = texture.innerShadowRect.height();
+
+        // the file is written aside and renamed on commit, so a concurrent
+        // reader never sees it half written
+        QSaveFile file( fileName );
+        if( !file.open( QIODevice::WriteOnly ) ) return;
+        file.write( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+        file.write( reinterpret_cast<const char *>( image.constBits() ), qint64( image.bytesPerLine() ) * image.height() );
+        file.commit();
+    }
+
+    //__________________________________________________________________
+    void ShadowProvider::pruneCachedTextures()
+    {
+        const QDir directory( shadowCacheDirectory() );
+        if( !directory.exists() ) return;
+
+        // files of other versions are never read again. Files being written
+        // have a temporary suffix, and are not listed
+        const QString prefix( QStringLiteral( "shadow-v%1-" ).arg( s_shadowCacheVersion ) );
+        const QFileInfoList files( directory.entryInfoList( { QStringLiteral( "shadow-v*.bin" ) }, QDir::Files, QDir::Time ) );
+
+        int kept = 0;
+        for( const QFileInfo &info : files )
+        {
+            // most recently used first
+            if( info.fileName().startsWith( prefix ) && ++kept <= s_shadowCacheMaxFiles ) continue;
+            QFile::remove( info.absoluteFilePath() );
+        }
+    }
+
+    //__________________________________________________________________
+    ShadowTexture ShadowProvider::render( const ShadowKey &key, qreal devicePixelRatio, int layers )
+    {
+        const CompositeShadowParams params = lookupShadowParams(key);
+        const ShadowGeometry geometry = lookupShadowGeometry(key);
+
+        auto withOpacity = [](const QColor &color, qreal opacity) -> QColor {
+            QColor c(color);
+            c.setAlphaF(opacity);
+            return c;
+        };
+
+        Breeze::BoxShadowRenderer shadowRenderer;
+        shadowRenderer.setBorderRadius(Metrics::Frame_FrameRadius + 0.5);
+        shadowRenderer.setBoxSize(geometry.boxSize);
+        shadowRenderer.setDevicePixelRatio(devicePixelRatio);
+
+        // on HiDPI outputs, computing the shadow in closed form avoids
+        // painting and blurring large intermediate images
+        shadowRenderer.setMethod(devicePixelRatio > 1.0
+            ? Breeze::BoxShadowRenderer::Method::Analytic
+            : Breeze::BoxShadowRenderer::Method::BoxBlur);
+
+        const qreal strength = static_cast<qreal>(key.strength) / 255.0;
+        shadowRenderer.addShadow(params.shadow1.offset, params.shadow1.radius,
+            withOpacity(key.color, params.shadow1.opacity * strength));
+        if (layers > 1) {
+            shadowRenderer.addShadow(params.shadow2.offset, params.shadow2.radius,
+                withOpacity(key.color, params.shadow2.opacity * strength));
+        }
+
+        QImage shadowTexture = shadowRenderer.render();
+
+        QPainter painter(&shadowTexture);
+        painter.setRenderHint(QPainter::Antialiasing);
+
+        // Mask out inner rect. The painter works in logical coordinates.
+        const QRect outerRect(QPoint(0, 0), geometry.textureSize);
+        const QRect innerRect = outerRect - geometry.padding;
+
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(Qt::black);
+        painter.setCompositionMode(QPainter::CompositionMode_DestinationOut);
+        painter.drawRoundedRect(
+            innerRect,
+            Metrics::Frame_FrameRadius + 0.5,
+            Metrics::Frame_FrameRadius + 0.5);
+
+        // Draw outline.
+        painter.setPen(withOpacity(key.color, 0.2 * strength));
+        painter.setBrush(Qt::NoBrush);
+        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+        painter.drawRoundedRect(
+            innerRect,
+            Metrics::Frame_FrameRadius - 0.5,
+            Metrics::Frame_FrameRadius - 0.5);
+
+        painter.end();
+
+        ShadowTexture texture;
+        texture.image = shadowTexture;
+        // DecorationShadow takes the size of the right and bottom slices from the
+        // image, so the padding and the inner shadow rect are in image pixels too
+        const QSize imageSize = shadowTexture.size();
+        texture.padding = QMargins(
+            qRound(geometry.padding.left() * devicePixelRatio),
+            qRound(geometry.padding.top() * devicePixelRatio),
+            imageSize.width() - qRound((geometry.textureSize.width() - geometry.padding.right()) * devicePixelRatio),
+            imageSize.height() - qRound((geometry.textureSize.height() - geometry.padding.bottom()) * devicePixelRatio));
+        texture.innerShadowRect = QRect(shadowTexture.rect().center(), QSize(1, 1));
+        return texture;
+    }
+
+}
@@ -0,0 +1,235 @@
+#ifndef arcshadowprovider_h
+#define arcshadowprovider_h
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "arc.h"
+#include "arcapplicationdata.h"
+
+#include <KDecoration2/DecorationShadow>
+
+#include <QCache>
+#include <QColor>
+#include <QFuture>
+#include <QHash>
+#include <QImage>
+#include <QMargins>
+#include <QObject>
+#include <QSharedPointer>
+#include <QTimer>
+
+namespace Arc
+{
+
+    //* settings a shadow texture depends on
+    struct ShadowKey
+    {
+        int size = InternalSettings::ShadowNone;
+        int strength = 0;
+        QColor color;
+
+        //* radius and offset of custom shadows, quantised. Zero otherwise
+        int radius = 0;
+        int offset = 0;
+
+        bool operator == ( const ShadowKey &other ) const
+        {
+            return size == other.size && strength == other.strength && color == other.color &&
+                radius == other.radius && offset == other.offset;
+        }
+
+        bool operator != ( const ShadowKey &other ) const
+        { return !( *this == other ); }
+    };
+
+    //* hash
+    inline uint qHash( const ShadowKey &key, uint seed = 0 )
+    { return qHash( key.size ^ ( key.strength << 4 ) ^ ( key.radius << 12 ) ^ ( key.offset << 20 ), seed ) ^ qHash( key.color.rgba() ); }
+
+    //* rendered shadow texture, along with its geometry
+    struct ShadowTexture
+    {
+        QImage image;
+        QMargins padding;
+        QRect innerShadowRect;
+    };
+
+    //* renders the shadows shared by all decorations, off the main thread
+    /**
+    one texture is kept per device pixel ratio in use, so that
+    decorations on HiDPI outputs get a crisp shadow
+    */
+    class ShadowProvider: public QObject
+    {
+
+        Q_OBJECT
+
+        public:
+
+        //* destructor. Waits for the renders in progress
+        ~ShadowProvider();
+
+        //* singleton, released with the application
+        static ShadowProvider *self();
+
+        //* current shadow for given device pixel ratio and active state. Null until rendered
+        /**
+        the shadow is cropped on given edges, for windows against a screen edge
+        not to draw shadow pixels off screen
+        */
+        QSharedPointer<KDecoration2::DecorationShadow> shadow( qreal devicePixelRatio, bool active, Qt::Edges edges = Qt::Edges() );
+
+        //* true while the shadow for given device pixel ratio and active state is being rendered
+        bool isPending( qreal devicePixelRatio, bool active ) const
+        {
+            const auto iter = m_shadows.constFind( scaleKey( devicePixelRatio ) );
+            return iter != m_shadows.constEnd() && iter->states[stateIndex( active )].pending;
+        }
+
+        //* request a shadow matching given settings
+        /**
+        rendering happens in a worker thread. The current shadows are kept
+        until the new ones are ready, then shadowChanged is emitted
+        */
+        void reconfigure( const InternalSettingsPtr & );
+
+        //*@name device pixel ratios in use
+        //@{
+
+        //* register a decoration at given device pixel ratio. Its shadow is rendered if needed
+        void ref( qreal devicePixelRatio );
+
+        //* unregister a decoration
+        /**
+        shadows no decoration uses anymore are released after a grace period,
+        so that decorations recreated all at once, as on settings reload, reuse them
+        */
+        void unref( qreal devicePixelRatio );
+
+        //@}
+
+        //* render shadow texture matching given key. This is thread safe
+        /**
+        a shadow is made of two blurred layers. Rendering the first one
+        only is meant for benchmarks, to tell their costs apart
+        */
+        static ShadowTexture render( const ShadowKey &, qreal devicePixelRatio, int layers = 2 );
+
+        Q_SIGNALS:
+
+        //* emitted when a shadow has been replaced
+        void shadowChanged();
+
+        private:
+
+        //* shadow rendered for one device pixel ratio and active state
+        struct ShadowState
+        {
+            //* generation of the last request, to drop outdated renders
+            int generation = 0;
+
+            //* true while rendering
+            bool pending = false;
+
+            //* shadow
+            QSharedPointer<KDecoration2::DecorationShadow> shadow;
+
+            //* shadow cropped on some edges, created on demand
+            QHash<int, QSharedPointer<KDecoration2::DecorationShadow>> croppedShadows;
+        };
+
+        //* shadows rendered for one device pixel ratio
+        struct ScaledShadow
+        {
+            //* number of decorations using it
+            int refCount = 0;
+
+            //* active and inactive shadows
+            ShadowState states[2];
+        };
+
+        //* constructor
+        ShadowProvider();
+
+        friend class ApplicationData<ShadowProvider>;
+
+        //* hash key for given device pixel ratio
+        static int scaleKey( qreal devicePixelRatio )
+        { return qRound( devicePixelRatio*100 ); }
+
+        //* index of the shadow for given active state. Both share the first one when identical
+        int stateIndex( bool active ) const
+        { return ( active || m_keys[1] == m_keys[0] ) ? 0 : 1; }
+
+        //* shadow key matching given settings, for given shadow size
+        static ShadowKey shadowKey( const InternalSettingsPtr &, int size );
+
+        //* render, or load, the shadow of given state index for given scale
+        void requestShadow( int scale, int index );
+
+        //*@name disk cache, under $XDG_CACHE_HOME
+        //@{
+
+        //* load texture matching given key. Returns false if missing or corrupt
+        static bool loadCachedTexture( const ShadowKey &, qreal devicePixelRatio, ShadowTexture & );
+
+        //* save texture matching given key. This is thread safe
+        static void saveCachedTexture( const ShadowKey &, qreal devicePixelRatio, const ShadowTexture & );
+
+        //* remove files of other versions, and all but the most recently used ones. This is thread safe
+        static void pruneCachedTextures();
+
+        //@}
+
+        //* shadow with no padding on given edges
+        static QSharedPointer<KDecoration2::DecorationShadow> cropShadow( const QSharedPointer<KDecoration2::DecorationShadow> &, Qt::Edges );
+
+        //* replace shadow of given state index for given scale
+        void setShadow( int scale, int index, const ShadowTexture & );
+
+        //* release shadows no decoration uses
+        void releaseUnused();
+
+        //* keys of the last requested active and inactive shadows
+        ShadowKey m_keys[2];
+
+        //* true once settings have been provided
+        bool m_configured = false;
+
+        //* incremented on every request, to drop outdated renders
+        int m_generation = 0;
+
+        //* shadows, per scale
+        QHash<int, ScaledShadow> m_shadows;
+
+        //* recently used textures, per key and scale, so that going back
+        //* to previous settings, as when scrubbing the radius in the configuration
+        //* dialog, needs no rendering. The cost is in kilobytes
+        QCache<QPair<ShadowKey, int>, ShadowTexture> m_textures;
+
+        //* delays the release of unused shadows
+        QTimer m_releaseTimer;
+
+        //* removal of outdated files from the disk cache
+        QFuture<void> m_pruning;
+
+    };
+
+}
+
+#endif
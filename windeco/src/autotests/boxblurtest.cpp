@@ -0,0 +1,81 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// own
+#include "breezeboxshadowrenderer.h"
+#include "breezeboxshadowrenderer_p.h"
+
+// Qt
+#include <QRandomGenerator>
+#include <QTest>
+
+#include <cstring>
+
+using namespace Breeze;
+
+Q_DECLARE_METATYPE(Breeze::BoxBlurKernel)
+
+/**
+ * Checks that blurring lines in lockstep gives the same result, to the
+ * bit, as blurring them one by one.
+ **/
+class BoxBlurTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void lockstep_data();
+    void lockstep();
+};
+
+void BoxBlurTest::lockstep_data()
+{
+    QTest::addColumn<BoxBlurKernel>("kernel");
+
+    QTest::newRow("vector") << BoxBlurKernel::Vector;
+    QTest::newRow("avx2") << BoxBlurKernel::Avx2;
+}
+
+void BoxBlurTest::lockstep()
+{
+    QFETCH(BoxBlurKernel, kernel);
+
+    // A fixed seed, so failures can be reproduced.
+    QRandomGenerator random(42);
+
+    for (int i = 0; i < 500; ++i) {
+        // Small radii give lines shorter than the lockstep width. Both the
+        // rows and the columns leave every possible remainder of lines.
+        const int radius = i < 100 ? random.bounded(4) : random.bounded(200);
+        const int extent = BoxShadowRenderer::calculateBlurExtent(radius);
+        const int width = extent + 1 + random.bounded(160);
+        const int height = extent + 1 + random.bounded(160);
+
+        QImage input(width, height, QImage::Format_Alpha8);
+        for (int y = 0; y < height; ++y) {
+            uchar *line = input.scanLine(y);
+            for (int x = 0; x < width; ++x) {
+                line[x] = random.bounded(4) ? random.bounded(256) : 255;
+            }
+        }
+
+        QImage scalar(input.copy());
+        QVERIFY(boxBlurAlphaWithKernel(scalar, radius, BoxBlurKernel::Scalar));
+
+        QImage lockstep(input.copy());
+        if (!boxBlurAlphaWithKernel(lockstep, radius, kernel)) {
+            QSKIP("Kernel not supported by this compiler or CPU");
+        }
+
+        for (int y = 0; y < height; ++y) {
+            if (std::memcmp(scalar.constScanLine(y), lockstep.constScanLine(y), width) != 0) {
+                QFAIL(qPrintable(QStringLiteral("Line %1 differs for radius %2, size %3x%4").arg(y).arg(radius).arg(width).arg(height)));
+            }
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(BoxBlurTest)
+
+#include "boxblurtest.moc"
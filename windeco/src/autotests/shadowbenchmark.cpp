@@ -0,0 +1,304 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "arcshadowprovider.h"
+
+#include "breezeboxshadowrenderer.h"
+#include "breezeboxshadowrenderer_p.h"
+
+#include <QFile>
+#include <QTest>
+
+#include <cstring>
+
+Q_DECLARE_METATYPE( Breeze::BoxBlurKernel )
+
+namespace Arc
+{
+
+    //* shadow rendering benchmarks
+    /**
+    run headless with QT_QPA_PLATFORM=offscreen. On Linux, the peak
+    memory of a shadow render is printed along with its time
+    */
+    class ShadowBenchmark: public QObject
+    {
+
+        Q_OBJECT
+
+        private Q_SLOTS:
+
+        //* every shadow size, at common scales, with one or both layers
+        void render_data();
+        void render();
+
+        //* analytic and box blur backends, for the blur radii of the presets
+        void method_data();
+        void method();
+
+        //* difference between the analytic and the box blur backends
+        void analyticError_data();
+        void analyticError();
+
+        //* box blur of a shadow quadrant, one line at a time, with strided columns, or in lockstep
+        void columnPass_data();
+        void columnPass();
+
+    };
+
+    namespace
+    {
+
+        //* renderer for a single shadow of given blur radius, with the box and corners of the Arc shadows
+        Breeze::BoxShadowRenderer shadowRenderer( int radius, qreal devicePixelRatio, Breeze::BoxShadowRenderer::Method method )
+        {
+            Breeze::BoxShadowRenderer renderer;
+            renderer.setMethod( method );
+            renderer.setBorderRadius( Metrics::Frame_FrameRadius + 0.5 );
+            renderer.setBoxSize( Breeze::BoxShadowRenderer::calculateMinimumBoxSize( radius ) );
+            renderer.setDevicePixelRatio( devicePixelRatio );
+            renderer.addShadow( QPoint( 0, 0 ), radius, Qt::black );
+            return renderer;
+        }
+
+        //* blur radii of the shadow layers of all presets
+        const QList<int> s_presetRadii = { 8, 16, 24, 32, 48, 64 };
+
+        //* given field of the process status, in KiB, or -1 where there is none
+        qint64 processStatus( const QByteArray &field )
+        {
+            QFile file( QStringLiteral( "/proc/self/status" ) );
+            if( !file.open( QIODevice::ReadOnly ) ) return -1;
+
+            for( const QByteArray &line : file.readAll().split( '\n' ) )
+            {
+                if( line.startsWith( field + ':' ) )
+                { return line.mid( field.size() + 1 ).simplified().split( ' ' ).first().toLongLong(); }
+            }
+
+            return -1;
+        }
+
+        //* reset the peak resident size of the process to its current resident size
+        bool resetPeakResidentSize()
+        {
+            QFile file( QStringLiteral( "/proc/self/clear_refs" ) );
+            return file.open( QIODevice::WriteOnly ) && file.write( "5" ) == 1;
+        }
+
+    }
+
+    //__________________________________________________________________
+    void ShadowBenchmark::render_data()
+    {
+        QTest::addColumn<int>( "size" );
+        QTest::addColumn<qreal>( "devicePixelRatio" );
+        QTest::addColumn<int>( "layers" );
+
+        // custom shadows use the default radius and offset
+        const QList<QPair<int, QString>> sizes = {
+            { InternalSettings::ShadowSmall, QStringLiteral( "small" ) },
+            { InternalSettings::ShadowMedium, QStringLiteral( "medium" ) },
+            { InternalSettings::ShadowLarge, QStringLiteral( "large" ) },
+            { InternalSettings::ShadowVeryLarge, QStringLiteral( "very large" ) },
+            { InternalSettings::ShadowCustom, QStringLiteral( "custom" ) }
+        };
+
+        for( const auto &size : sizes )
+        {
+            for( const qreal devicePixelRatio : { 1.0, 1.5, 2.0, 3.0 } )
+            {
+                for( int layers = 1; layers <= 2; ++layers )
+                {
+                    const QString name( QStringLiteral( "%1, scale %2, %3 layer(s)" ).arg( size.second ).arg( devicePixelRatio ).arg( layers ) );
+                    QTest::newRow( qPrintable( name ) ) << size.first << devicePixelRatio << layers;
+                }
+            }
+        }
+    }
+
+    //__________________________________________________________________
+    void ShadowBenchmark::render()
+    {
+        QFETCH( int, size );
+        QFETCH( qreal, devicePixelRatio );
+        QFETCH( int, layers );
+
+        ShadowKey key;
+        key.size = size;
+        key.strength = 255;
+        key.color = Qt::black;
+        if( size == InternalSettings::ShadowCustom )
+        {
+            key.radius = 32;
+            key.offset = 8;
+        }
+
+        ShadowTexture texture;
+        QBENCHMARK { texture = ShadowProvider::render( key, devicePixelRatio, layers ); }
+
+        QVERIFY( !texture.image.isNull() );
+        QCOMPARE( texture.image.devicePixelRatioF(), devicePixelRatio );
+        // peak memory of one more render, with the texture, the canvas, the Alpha8 layers
+        // and the blur buffers. Allocations served from memory the process already
+        // holds are not counted, which makes it a lower bound
+        if( !resetPeakResidentSize() ) return;
+        const qint64 resident( processStatus( "VmRSS" ) );
+        const ShadowTexture measured( ShadowProvider::render( key, devicePixelRatio, layers ) );
+        const qint64 peak( processStatus( "VmHWM" ) );
+        if( resident < 0 || peak < 0 ) return;
+
+        qInfo( "peak memory: %lld KiB, texture: %dx%d", peak - resident, measured.image.width(), measured.image.height() );
+    }
+
+    //__________________________________________________________________
+    void ShadowBenchmark::method_data()
+    {
+        QTest::addColumn<int>( "radius" );
+        QTest::addColumn<qreal>( "devicePixelRatio" );
+        QTest::addColumn<bool>( "analytic" );
+
+        for( const int radius : s_presetRadii )
+        {
+            for( const qreal devicePixelRatio : { 1.0, 2.0 } )
+            {
+                const QString name( QStringLiteral( "radius %1, scale %2, " ).arg( radius ).arg( devicePixelRatio ) );
+                QTest::newRow( qPrintable( name + QStringLiteral( "box blur" ) ) ) << radius << devicePixelRatio << false;
+                QTest::newRow( qPrintable( name + QStringLiteral( "analytic" ) ) ) << radius << devicePixelRatio << true;
+            }
+        }
+    }
+
+    //__________________________________________________________________
+    void ShadowBenchmark::method()
+    {
+        QFETCH( int, radius );
+        QFETCH( qreal, devicePixelRatio );
+        QFETCH( bool, analytic );
+
+        const Breeze::BoxShadowRenderer renderer( shadowRenderer( radius, devicePixelRatio, analytic
+            ? Breeze::BoxShadowRenderer::Method::Analytic
+            : Breeze::BoxShadowRenderer::Method::BoxBlur ) );
+
+        QImage image;
+        QBENCHMARK { image = renderer.render(); }
+        QVERIFY( !image.isNull() );
+    }
+
+    //__________________________________________________________________
+    void ShadowBenchmark::analyticError_data()
+    {
+        QTest::addColumn<int>( "radius" );
+        QTest::addColumn<qreal>( "devicePixelRatio" );
+
+        for( const int radius : s_presetRadii )
+        {
+            for( const qreal devicePixelRatio : { 1.0, 1.5, 2.0, 3.0 } )
+            {
+                const QString name( QStringLiteral( "radius %1, scale %2" ).arg( radius ).arg( devicePixelRatio ) );
+                QTest::newRow( qPrintable( name ) ) << radius << devicePixelRatio;
+            }
+        }
+    }
+
+    //__________________________________________________________________
+    void ShadowBenchmark::analyticError()
+    {
+        QFETCH( int, radius );
+        QFETCH( qreal, devicePixelRatio );
+
+        const QImage blurred( shadowRenderer( radius, devicePixelRatio, Breeze::BoxShadowRenderer::Method::BoxBlur ).render() );
+        const QImage analytic( shadowRenderer( radius, devicePixelRatio, Breeze::BoxShadowRenderer::Method::Analytic ).render() );
+        QCOMPARE( analytic.size(), blurred.size() );
+
+        // alpha differences, out of 255
+        int maxError = 0;
+        qint64 totalError = 0;
+        for( int y = 0; y < blurred.height(); ++y )
+        {
+            const QRgb *blurredLine = reinterpret_cast<const QRgb *>( blurred.constScanLine( y ) );
+            const QRgb *analyticLine = reinterpret_cast<const QRgb *>( analytic.constScanLine( y ) );
+            for( int x = 0; x < blurred.width(); ++x )
+            {
+                const int error = qAbs( qAlpha( blurredLine[x] ) - qAlpha( analyticLine[x] ) );
+                maxError = qMax( maxError, error );
+                totalError += error;
+            }
+        }
+
+        const qreal meanError = qreal( totalError )/( blurred.width()*blurred.height() );
+        qInfo( "max error: %d, mean error: %.3f", maxError, meanError );
+
+        // three box filters approximate the Gaussian of the analytic backend. The
+        // bounds leave some room over the measured errors, of at most 8 and 2.5
+        QVERIFY2( maxError <= 12, qPrintable( QStringLiteral( "max error %1" ).arg( maxError ) ) );
+        QVERIFY2( meanError <= 3.0, qPrintable( QStringLiteral( "mean error %1" ).arg( meanError ) ) );
+    }
+
+    //__________________________________________________________________
+    void ShadowBenchmark::columnPass_data()
+    {
+        QTest::addColumn<int>( "radius" );
+        QTest::addColumn<qreal>( "devicePixelRatio" );
+        QTest::addColumn<Breeze::BoxBlurKernel>( "kernel" );
+
+        for( const int radius : s_presetRadii )
+        {
+            for( const qreal devicePixelRatio : { 2.0, 3.0 } )
+            {
+                const QString name( QStringLiteral( "radius %1, scale %2, " ).arg( radius ).arg( devicePixelRatio ) );
+                QTest::newRow( qPrintable( name + QStringLiteral( "strided" ) ) ) << radius << devicePixelRatio << Breeze::BoxBlurKernel::Scalar;
+                QTest::newRow( qPrintable( name + QStringLiteral( "lockstep" ) ) ) << radius << devicePixelRatio << Breeze::BoxBlurKernel::Vector;
+            }
+        }
+    }
+
+    //__________________________________________________________________
+    void ShadowBenchmark::columnPass()
+    {
+        QFETCH( int, radius );
+        QFETCH( qreal, devicePixelRatio );
+        QFETCH( Breeze::BoxBlurKernel, kernel );
+
+        // top left quadrant of the box blurred shadow, with the box in its bottom right corner
+        const int extent = Breeze::BoxShadowRenderer::calculateBlurExtent( radius );
+        const int boxSize = Breeze::BoxShadowRenderer::calculateMinimumBoxSize( radius ).width();
+        const int size = ( qRound( ( boxSize + 2*extent )*devicePixelRatio ) + 1 )/2;
+
+        QImage quadrant( size, size, QImage::Format_Alpha8 );
+        quadrant.fill( 0 );
+        for( int y = size/2; y < size; ++y )
+        { std::memset( quadrant.scanLine( y ) + size/2, 255, size - size/2 ); }
+
+        const int scaledRadius = qRound( radius*devicePixelRatio );
+        QImage image( quadrant.copy() );
+        if( !Breeze::boxBlurAlphaWithKernel( image, scaledRadius, kernel ) )
+        { QSKIP( "Kernel not supported by this compiler" ); }
+
+        QBENCHMARK
+        {
+            image = quadrant.copy();
+            Breeze::boxBlurAlphaWithKernel( image, scaledRadius, kernel );
+        }
+    }
+
+}
+
+QTEST_MAIN( Arc::ShadowBenchmark )
+
+#include "shadowbenchmark.moc"
@@ -58,9 +58,16 @@ namespace Arc
 
         // track shadows changes
         connect( m_ui.shadowSize, SIGNAL(currentIndexChanged(int)), SLOT(updateChanged()) );
+        connect( m_ui.inactiveShadowSize, SIGNAL(currentIndexChanged(int)), SLOT(updateChanged()) );
+        connect( m_ui.shadowRadius, SIGNAL(valueChanged(int)), SLOT(updateChanged()) );
+        connect( m_ui.shadowOffset, SIGNAL(valueChanged(int)), SLOT(updateChanged()) );
         connect( m_ui.shadowStrength, SIGNAL(valueChanged(int)), SLOT(updateChanged()) );
         connect( m_ui.shadowColor, &KColorButton::changed, this, &ConfigWidget::updateChanged );
 
+        // radius and offset only apply to custom shadows
+        connect( m_ui.shadowSize, SIGNAL(currentIndexChanged(int)), SLOT(updateShadowControls()) );
+        connect( m_ui.inactiveShadowSize, SIGNAL(currentIndexChanged(int)), SLOT(updateShadowControls()) );
+
         // track exception changes
         connect( m_ui.exceptions, &ExceptionListWidget::changed, this, &ConfigWidget::updateChanged );
 
@@ -85,11 +92,18 @@ namespace Arc
         m_ui.animationsDuration->setValue( m_internalSettings->animationsDuration() );
 
         // load shadows
-        if( m_internalSettings->shadowSize() <= InternalSettings::ShadowVeryLarge ) m_ui.shadowSize->setCurrentIndex( m_internalSettings->shadowSize() );
+        if( m_internalSettings->shadowSize() <= InternalSettings::ShadowCustom ) m_ui.shadowSize->setCurrentIndex( m_internalSettings->shadowSize() );
         else m_ui.shadowSize->setCurrentIndex( InternalSettings::ShadowLarge );
 
+        // the first item of the inactive size stands for the active size
+        if( m_internalSettings->inactiveShadowSize() <= InternalSettings::ShadowCustom ) m_ui.inactiveShadowSize->setCurrentIndex( m_internalSettings->inactiveShadowSize() + 1 );
+        else m_ui.inactiveShadowSize->setCurrentIndex( 0 );
+
+        m_ui.shadowRadius->setValue( m_internalSettings->shadowRadius() );
+        m_ui.shadowOffset->setValue( m_internalSettings->shadowOffset() );
         m_ui.shadowStrength->setValue( qRound(qreal(m_internalSettings->shadowStrength()*100)/255 ) );
         m_ui.shadowColor->setColor( m_internalSettings->shadowColor() );
+        updateShadowControls();
 
         // load exceptions
         ExceptionList exceptions;
@@ -118,6 +132,9 @@ namespace Arc
         m_internalSettings->setAnimationsDuration( m_ui.animationsDuration->value() );
 
         m_internalSettings->setShadowSize( m_ui.shadowSize->currentIndex() );
+        m_internalSettings->setInactiveShadowSize( m_ui.inactiveShadowSize->currentIndex() - 1 );
+        m_internalSettings->setShadowRadius( m_ui.shadowRadius->value() );
+        m_internalSettings->setShadowOffset( m_ui.shadowOffset->value() );
         m_internalSettings->setShadowStrength( qRound( qreal(m_ui.shadowStrength->value()*255)/100 ) );
         m_internalSettings->setShadowColor( m_ui.shadowColor->color() );
 
@@ -165,6 +182,9 @@ namespace Arc
         m_ui.animationsDuration->setValue( m_internalSettings->animationsDuration() );
 
         m_ui.shadowSize->setCurrentIndex( m_internalSettings->shadowSize() );
+        m_ui.inactiveShadowSize->setCurrentIndex( m_internalSettings->inactiveShadowSize() + 1 );
+        m_ui.shadowRadius->setValue( m_internalSettings->shadowRadius() );
+        m_ui.shadowOffset->setValue( m_internalSettings->shadowOffset() );
         m_ui.shadowStrength->setValue( qRound(qreal(m_internalSettings->shadowStrength()*100)/255 ) );
         m_ui.shadowColor->setColor( m_internalSettings->shadowColor() );
 
@@ -192,6 +212,9 @@ namespace Arc
 
         // shadows
         else if( m_ui.shadowSize->currentIndex() !=  m_internalSettings->shadowSize() ) modified = true;
+        else if( m_ui.inactiveShadowSize->currentIndex() - 1 != m_internalSettings->inactiveShadowSize() ) modified = true;
+        else if( m_ui.shadowRadius->value() != m_internalSettings->shadowRadius() ) modified = true;
+        else if( m_ui.shadowOffset->value() != m_internalSettings->shadowOffset() ) modified = true;
         else if( qRound( qreal(m_ui.shadowStrength->value()*255)/100 ) != m_internalSettings->shadowStrength() ) modified = true;
         else if( m_ui.shadowColor->color() != m_internalSettings->shadowColor() ) modified = true;
 
@@ -202,6 +225,19 @@ namespace Arc
 
     }
 
+    //_______________________________________________
+    void ConfigWidget::updateShadowControls()
+    {
+        const bool custom(
+            m_ui.shadowSize->currentIndex() == InternalSettings::ShadowCustom ||
+            m_ui.inactiveShadowSize->currentIndex() - 1 == InternalSettings::ShadowCustom );
+
+        m_ui.shadowRadiusLabel->setEnabled( custom );
+        m_ui.shadowRadius->setEnabled( custom );
+        m_ui.shadowOffsetLabel->setEnabled( custom );
+        m_ui.shadowOffset->setEnabled( custom );
+    }
+
     //_______________________________________________
     void ConfigWidget::setChanged( bool value )
     {
@@ -67,6 +67,9 @@ namespace Arc
         //* update changed state
         virtual void updateChanged();
 
+        //* enable radius and offset when a custom shadow is selected
+        void updateShadowControls();
+
         protected:
 
         //* set changed state
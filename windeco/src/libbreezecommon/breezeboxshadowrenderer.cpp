@@ -17,86 +17,115 @@
 
 // own
 #include "breezeboxshadowrenderer.h"
+#include "breezeboxshadowrenderer_p.h"
 
 // Qt
 #include <QPainter>
+#include <QThreadPool>
+#include <QtConcurrentMap>
 #include <QtMath>
 
 namespace Breeze
 {
 
-static inline int calculateBlurRadius(qreal stdDev)
-{
-    // See https://www.w3.org/TR/SVG11/filters.html#feGaussianBlurElement
-    const qreal gaussianScaleFactor = (3.0 * qSqrt(2.0 * M_PI) / 4.0) * 1.5;
-    return qMax(2, qFloor(stdDev * gaussianScaleFactor + 0.5));
-}
-
-static inline qreal calculateBlurStdDev(int radius)
+static constexpr qreal calculateBlurStdDev(int radius)
 {
     // See https://www.w3.org/TR/css-backgrounds-3/#shadow-blur
     return radius * 0.5;
 }
 
-static inline QSize calculateBlurExtent(int radius)
-{
-    const int blurRadius = calculateBlurRadius(calculateBlurStdDev(radius));
-    return QSize(blurRadius, blurRadius);
-}
-
 struct BoxLobes
 {
     int left;  ///< how many pixels sample to the left
     int right; ///< how many pixels sample to the right
 };
 
+struct BoxKernel
+{
+    BoxLobes lobes[3]; ///< params of the three box filters
+
+    constexpr const BoxLobes &operator[](int i) const
+    {
+        return lobes[i];
+    }
+};
+
 /**
  * Compute box filter parameters.
  *
  * @param radius The blur radius.
  * @returns Parameters for three box filters.
  **/
-static QVector<BoxLobes> computeLobes(int radius)
+static constexpr BoxKernel computeLobes(int radius)
 {
-    const int blurRadius = calculateBlurRadius(calculateBlurStdDev(radius));
+    const int blurRadius = BoxShadowRenderer::calculateBlurExtent(radius);
     const int z = blurRadius / 3;
 
-    int major;
-    int minor;
-    int final;
-
-    switch (blurRadius % 3) {
-    case 0:
-        major = z;
-        minor = z;
-        final = z;
-        break;
+    int major = z;
+    int minor = z;
+    int final = z;
 
-    case 1:
+    if (blurRadius % 3 == 1) {
         major = z + 1;
-        minor = z;
-        final = z;
-        break;
-
-    case 2:
+    } else if (blurRadius % 3 == 2) {
         major = z + 1;
-        minor = z;
         final = z + 1;
-        break;
-
-    default:
-        Q_UNREACHABLE();
     }
 
-    Q_ASSERT(major + minor + final == blurRadius);
-
-    return {
+    return {{
         {major, minor},
         {minor, major},
         {final, final}
-    };
+    }};
+}
+
+// Blur radii whose box filter parameters are computed at compile time. That
+// covers the largest Arc shadow, 64, up to a device pixel ratio of 3.
+static const int s_lobesTableSize = 193;
+
+struct BoxKernelTable
+{
+    BoxKernel kernels[s_lobesTableSize];
+};
+
+static constexpr BoxKernelTable computeLobesTable()
+{
+    BoxKernelTable table = {};
+    for (int radius = 0; radius < s_lobesTableSize; ++radius) {
+        table.kernels[radius] = computeLobes(radius);
+    }
+    return table;
+}
+
+static constexpr BoxKernelTable s_lobesTable = computeLobesTable();
+
+/**
+ * Look up box filter parameters.
+ *
+ * @param radius The blur radius.
+ * @returns Parameters for three box filters.
+ **/
+static inline BoxKernel lookupLobes(int radius)
+{
+    return radius >= 0 && radius < s_lobesTableSize ? s_lobesTable.kernels[radius] : computeLobes(radius);
 }
 
+// Pin the parameters of the blur radii used by the Arc shadows, at scale 1 and 2.
+static_assert(BoxShadowRenderer::calculateBlurExtent(8) == 11, "blur extent of radius 8");
+static_assert(BoxShadowRenderer::calculateBlurExtent(16) == 23, "blur extent of radius 16");
+static_assert(BoxShadowRenderer::calculateBlurExtent(32) == 45, "blur extent of radius 32");
+static_assert(BoxShadowRenderer::calculateBlurExtent(64) == 90, "blur extent of radius 64");
+static_assert(BoxShadowRenderer::calculateBlurExtent(128) == 180, "blur extent of radius 128");
+static_assert(s_lobesTable.kernels[16][0].left == 8 && s_lobesTable.kernels[16][0].right == 7
+                  && s_lobesTable.kernels[16][1].left == 7 && s_lobesTable.kernels[16][1].right == 8
+                  && s_lobesTable.kernels[16][2].left == 8 && s_lobesTable.kernels[16][2].right == 8,
+              "box filters of radius 16");
+static_assert(s_lobesTable.kernels[64][0].left == 30 && s_lobesTable.kernels[64][0].right == 30
+                  && s_lobesTable.kernels[64][2].left == 30,
+              "box filters of radius 64");
+static_assert(s_lobesTable.kernels[0][0].left + s_lobesTable.kernels[0][1].left + s_lobesTable.kernels[0][2].left == 2,
+              "box filters of the smallest radius");
+
 /**
  * Process a row with a box filter.
  *
@@ -164,93 +193,424 @@ static inline void boxBlurRowAlpha(const uint8_t *src, uint8_t *dst, int width,
 }
 
 /**
- * Blur the alpha channel of a given image.
+ * Blur s_blurLanes lines with the three box filters, in lockstep.
+ **/
+typedef void (*BoxBlurLanesFunc)(uint32_t *, uint32_t *, int, const BoxKernel &);
+
+#if defined(Q_CC_GNU)
+#define BREEZE_HAVE_VECTOR_BLUR 1
+#else
+#define BREEZE_HAVE_VECTOR_BLUR 0
+#endif
+
+#if BREEZE_HAVE_VECTOR_BLUR
+
+/**
+ * Number of rows (or columns) that are blurred in lockstep.
  *
- * @param image The input image.
- * @param radius The blur radius.
- * @param rect Specifies what part of the image to blur. If nothing is provided, then
- *    the whole alpha channel of the input image will be blurred.
+ * Each line gets its own 32 bit lane. The lanes are processed in vectors
+ * of 8 lanes, which is one AVX2 register or two SSE2 registers.
  **/
-static inline void boxBlurAlpha(QImage &image, int radius, const QRect &rect = {})
+static const int s_blurLanes = 16;
+static const int s_blurVectorLanes = 8;
+
+// Lane buffers are not aligned to the vector size, hence the reduced alignment.
+typedef uint32_t BlurLanes __attribute__((vector_size(s_blurVectorLanes * sizeof(uint32_t)), aligned(4)));
+
+#define loadLanes(src) (*reinterpret_cast<const BlurLanes *>(src))
+#define storeLanes(dst, lanes) (*reinterpret_cast<BlurLanes *>(dst) = (lanes))
+
+/**
+ * Process s_blurVectorLanes lines with a box filter at once.
+ *
+ * This is the same running sum as in boxBlurRowAlpha(), evaluated for every
+ * lane in parallel, so the result is bit-identical to the scalar version.
+ *
+ * @param src The input lines. The value of line j at position i is stored at
+ *    src[i * s_blurLanes + j].
+ * @param dst The destination, same layout as @p src.
+ * @param width The length of the lines, in pixels.
+ * @param lobes Params of the box filter.
+ **/
+static Q_ALWAYS_INLINE void boxBlurLanesAlpha(const uint32_t *src, uint32_t *dst, int width, const BoxLobes &lobes)
 {
-    if (radius < 2) {
-        return;
+    const int boxSize = lobes.left + 1 + lobes.right;
+    const uint32_t reciprocal = (1 << 24) / boxSize;
+
+    const BlurLanes firstValue = loadLanes(src);
+    const BlurLanes lastValue = loadLanes(src + (width - 1) * s_blurLanes);
+
+    BlurLanes alphaSum = firstValue * uint32_t(lobes.left) + uint32_t((boxSize + 1) / 2);
+
+    int left = 0;
+    int right = 0;
+    int out = 0;
+
+    for (; right < boxSize - lobes.left; ++right) {
+        alphaSum += loadLanes(src + right * s_blurLanes);
     }
 
-    const QVector<BoxLobes> lobes = computeLobes(radius);
+    for (; right < boxSize; ++right, ++out) {
+        storeLanes(dst + out * s_blurLanes, (alphaSum * reciprocal) >> 24);
+        alphaSum += loadLanes(src + right * s_blurLanes) - firstValue;
+    }
 
-    const QRect blurRect = rect.isNull() ? image.rect() : rect;
+    for (; right < width; ++right, ++left, ++out) {
+        storeLanes(dst + out * s_blurLanes, (alphaSum * reciprocal) >> 24);
+        alphaSum += loadLanes(src + right * s_blurLanes) - loadLanes(src + left * s_blurLanes);
+    }
 
-    const int alphaOffset = QSysInfo::ByteOrder == QSysInfo::BigEndian ? 0 : 3;
-    const int width = blurRect.width();
-    const int height = blurRect.height();
-    const int rowStride = image.bytesPerLine();
-    const int pixelStride = image.depth() >> 3;
+    for (; out < width; ++left, ++out) {
+        storeLanes(dst + out * s_blurLanes, (alphaSum * reciprocal) >> 24);
+        alphaSum += lastValue - loadLanes(src + left * s_blurLanes);
+    }
+}
+
+#undef loadLanes
+#undef storeLanes
+
+static Q_ALWAYS_INLINE void boxBlurLanesAlpha3(uint32_t *buf1, uint32_t *buf2, int width, const BoxKernel &lobes)
+{
+    for (int lane = 0; lane < s_blurLanes; lane += s_blurVectorLanes) {
+        boxBlurLanesAlpha(buf1 + lane, buf2 + lane, width, lobes[0]);
+        boxBlurLanesAlpha(buf2 + lane, buf1 + lane, width, lobes[1]);
+        boxBlurLanesAlpha(buf1 + lane, buf2 + lane, width, lobes[2]);
+    }
+}
+
+// The vector code is compiled twice: once for the baseline instruction set
+// (SSE2 on x86-64) and once for AVX2. The best one is picked at runtime.
+static void boxBlurLanesAlpha3Generic(uint32_t *buf1, uint32_t *buf2, int width, const BoxKernel &lobes)
+{
+    boxBlurLanesAlpha3(buf1, buf2, width, lobes);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void boxBlurLanesAlpha3Avx2(uint32_t *buf1, uint32_t *buf2, int width, const BoxKernel &lobes)
+{
+    boxBlurLanesAlpha3(buf1, buf2, width, lobes);
+}
+#endif
+
+static BoxBlurLanesFunc resolveBoxBlurLanes()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        return boxBlurLanesAlpha3Avx2;
+    }
+#endif
+    return boxBlurLanesAlpha3Generic;
+}
+
+/**
+ * The best lockstep kernel the CPU supports.
+ **/
+static BoxBlurLanesFunc defaultBoxBlurLanes()
+{
+    static const BoxBlurLanesFunc blurLanes = resolveBoxBlurLanes();
+    return blurLanes;
+}
+
+/**
+ * Blur s_blurLanes lines of the alpha channel in lockstep.
+ *
+ * @param first Points to the alpha value of the first pixel of the first line.
+ * @param width The length of the lines, in pixels.
+ * @param lineStride The number of bytes from one line to the next line.
+ * @param step The number of bytes from one pixel to the next pixel in a line.
+ * @param lobes Params of the box filters.
+ * @param blurLanes The lockstep kernel.
+ * @param buf1 Scratch buffer of width * s_blurLanes values.
+ * @param buf2 Scratch buffer of width * s_blurLanes values.
+ **/
+static inline void boxBlurLinesAlpha(uint8_t *first, int width, int lineStride, int step, const BoxKernel &lobes,
+                                     BoxBlurLanesFunc blurLanes, uint32_t *buf1, uint32_t *buf2)
+{
+    for (int i = 0; i < width; ++i) {
+        const uint8_t *in = first + i * step;
+        for (int j = 0; j < s_blurLanes; ++j, in += lineStride) {
+            buf1[i * s_blurLanes + j] = *in;
+        }
+    }
+
+    blurLanes(buf1, buf2, width, lobes);
 
-    const int bufferStride = qMax(width, height) * pixelStride;
+    for (int i = 0; i < width; ++i) {
+        uint8_t *out = first + i * step;
+        for (int j = 0; j < s_blurLanes; ++j, out += lineStride) {
+            *out = buf2[i * s_blurLanes + j];
+        }
+    }
+}
+
+#endif
+
+/**
+ * Part of an image whose alpha channel is blurred.
+ **/
+struct BlurArea
+{
+    uint8_t *alpha;          ///< the first alpha value of the area
+    int width;               ///< the width of the area, in pixels
+    int height;              ///< the height of the area, in pixels
+    int rowStride;           ///< the number of bytes from one row to the next row
+    int pixelStride;         ///< the number of bytes from one alpha value to the next
+    BoxKernel lobes; ///< params of the three box filters
+    BoxBlurLanesFunc blurLanes; ///< the lockstep kernel, or null to blur lines one by one
+};
+
+/**
+ * A range of rows or columns of a blur area, processed by one thread.
+ **/
+struct BlurJob
+{
+    const BlurArea *area;
+    int first; ///< the first row or column
+    int last;  ///< one past the last row or column
+};
+
+/**
+ * Minimum number of rows or columns per job. Splitting the work further
+ * costs more in thread synchronization than it saves.
+ **/
+static const int s_minLinesPerJob = 64;
+
+/**
+ * Blur some rows of a blur area in horizontal direction.
+ **/
+static void boxBlurRowsAlpha(const BlurJob &job)
+{
+    const BlurArea &area = *job.area;
+    const BoxKernel &lobes = area.lobes;
+    const int width = area.width;
+    const int rowStride = area.rowStride;
+    const int pixelStride = area.pixelStride;
+
+    int firstRow = job.first;
+
+#if BREEZE_HAVE_VECTOR_BLUR
+    if (area.blurLanes) {
+        QScopedPointer<uint32_t, QScopedPointerArrayDeleter<uint32_t> > laneBuf(new uint32_t[2 * width * s_blurLanes]);
+        uint32_t *laneBuf1 = laneBuf.data();
+        uint32_t *laneBuf2 = laneBuf1 + width * s_blurLanes;
+
+        // Blur groups of rows in lockstep.
+        for (; firstRow + s_blurLanes <= job.last; firstRow += s_blurLanes) {
+            boxBlurLinesAlpha(area.alpha + firstRow * rowStride, width, rowStride, pixelStride, lobes, area.blurLanes, laneBuf1, laneBuf2);
+        }
+    }
+#endif
+
+    if (firstRow == job.last) {
+        return;
+    }
+
+    const int bufferStride = width * pixelStride;
     QScopedPointer<uint8_t, QScopedPointerArrayDeleter<uint8_t> > buf(new uint8_t[2 * bufferStride]);
     uint8_t *buf1 = buf.data();
     uint8_t *buf2 = buf1 + bufferStride;
 
-    // Blur the image in horizontal direction.
-    for (int i = 0; i < height; ++i) {
-        uint8_t *row = image.scanLine(blurRect.y() + i) + blurRect.x() * pixelStride + alphaOffset;
+    for (int i = firstRow; i < job.last; ++i) {
+        uint8_t *row = area.alpha + i * rowStride;
         boxBlurRowAlpha(row, buf1, width, pixelStride, rowStride, lobes[0], false, false);
         boxBlurRowAlpha(buf1, buf2, width, pixelStride, rowStride, lobes[1], false, false);
         boxBlurRowAlpha(buf2, row, width, pixelStride, rowStride, lobes[2], false, false);
     }
+}
 
-    // Blur the image in vertical direction.
-    for (int i = 0; i < width; ++i) {
-        uint8_t *column = image.scanLine(blurRect.y()) + (blurRect.x() + i) * pixelStride + alphaOffset;
+/**
+ * Blur some columns of a blur area in vertical direction.
+ **/
+static void boxBlurColumnsAlpha(const BlurJob &job)
+{
+    const BlurArea &area = *job.area;
+    const BoxKernel &lobes = area.lobes;
+    const int height = area.height;
+    const int rowStride = area.rowStride;
+    const int pixelStride = area.pixelStride;
+
+    int firstColumn = job.first;
+
+#if BREEZE_HAVE_VECTOR_BLUR
+    if (area.blurLanes) {
+        QScopedPointer<uint32_t, QScopedPointerArrayDeleter<uint32_t> > laneBuf(new uint32_t[2 * height * s_blurLanes]);
+        uint32_t *laneBuf1 = laneBuf.data();
+        uint32_t *laneBuf2 = laneBuf1 + height * s_blurLanes;
+
+        // Blur groups of columns in lockstep. Gathering a group reads one cache
+        // line per row, so this is a cache-blocked transpose already.
+        for (; firstColumn + s_blurLanes <= job.last; firstColumn += s_blurLanes) {
+            boxBlurLinesAlpha(area.alpha + firstColumn * pixelStride, height, pixelStride, rowStride, lobes, area.blurLanes, laneBuf1, laneBuf2);
+        }
+    }
+#endif
+
+    if (firstColumn == job.last) {
+        return;
+    }
+
+    const int bufferStride = height * pixelStride;
+    QScopedPointer<uint8_t, QScopedPointerArrayDeleter<uint8_t> > buf(new uint8_t[2 * bufferStride]);
+    uint8_t *buf1 = buf.data();
+    uint8_t *buf2 = buf1 + bufferStride;
+
+    for (int i = firstColumn; i < job.last; ++i) {
+        uint8_t *column = area.alpha + i * pixelStride;
         boxBlurRowAlpha(column, buf1, height, pixelStride, rowStride, lobes[0], true, false);
         boxBlurRowAlpha(buf1, buf2, height, pixelStride, rowStride, lobes[1], false, false);
         boxBlurRowAlpha(buf2, column, height, pixelStride, rowStride, lobes[2], false, true);
     }
 }
 
-static inline void mirrorTopLeftQuadrant(QImage &image)
+/**
+ * Split the rows or columns of a blur area into jobs.
+ *
+ * Job boundaries are multiples of the lockstep width, so every line takes
+ * the same code path no matter how many threads there are.
+ *
+ * @param jobs The list the jobs are appended to.
+ * @param area The blur area.
+ * @param lineCount The number of rows or columns of the area.
+ **/
+static void appendBlurJobs(QVector<BlurJob> &jobs, const BlurArea *area, int lineCount)
+{
+#if BREEZE_HAVE_VECTOR_BLUR
+    const int granularity = s_blurLanes;
+#else
+    const int granularity = 1;
+#endif
+
+    const int jobCount = qBound(1, lineCount / s_minLinesPerJob, QThreadPool::globalInstance()->maxThreadCount());
+    int linesPerJob = (lineCount + jobCount - 1) / jobCount;
+    linesPerJob = (linesPerJob + granularity - 1) / granularity * granularity;
+
+    for (int first = 0; first < lineCount; first += linesPerJob) {
+        jobs.append({area, first, qMin(first + linesPerJob, lineCount)});
+    }
+}
+
+/**
+ * Run blur jobs, on the global thread pool if there is more than one.
+ **/
+static void runBlurJobs(QVector<BlurJob> &jobs, void (*blur)(const BlurJob &))
+{
+    if (jobs.count() == 1) {
+        blur(jobs.first());
+        return;
+    }
+
+    QtConcurrent::blockingMap(jobs, [blur](BlurJob &job) {
+        blur(job);
+    });
+}
+
+/**
+ * Describe the part of an image whose alpha channel is to be blurred.
+ *
+ * @param image The input image, in Format_Alpha8.
+ * @param radius The blur radius.
+ * @param rect Specifies what part of the image to blur. If nothing is provided, then
+ *    the whole alpha channel of the input image will be blurred.
+ * @returns The area to be passed to boxBlurAlpha().
+ **/
+static BlurArea blurArea(QImage &image, int radius, const QRect &rect = {})
 {
-    const int width = image.width();
-    const int height = image.height();
+    Q_ASSERT(image.format() == QImage::Format_Alpha8);
+
+    const QRect blurRect = rect.isNull() ? image.rect() : rect;
 
-    const int centerX = qCeil(width * 0.5);
-    const int centerY = qCeil(height * 0.5);
+    BlurArea area;
+    area.alpha = image.scanLine(blurRect.y()) + blurRect.x();
+    area.width = blurRect.width();
+    area.height = blurRect.height();
+    area.rowStride = image.bytesPerLine();
+    area.pixelStride = 1;
+    area.lobes = lookupLobes(radius);
+#if BREEZE_HAVE_VECTOR_BLUR
+    area.blurLanes = defaultBoxBlurLanes();
+#else
+    area.blurLanes = nullptr;
+#endif
+    return area;
+}
 
-    const int alphaOffset = QSysInfo::ByteOrder == QSysInfo::BigEndian ? 0 : 3;
-    const int stride = image.depth() >> 3;
+/**
+ * Blur the alpha channel of several areas.
+ *
+ * Rows and columns are spread over the global thread pool. Each line is
+ * blurred independently of the others, so the result doesn't depend on the
+ * number of threads.
+ *
+ * @param areas The areas, as returned by blurArea().
+ **/
+static void boxBlurAlpha(const QVector<BlurArea> &areas)
+{
+    QVector<BlurJob> rowJobs;
+    QVector<BlurJob> columnJobs;
 
-    for (int y = 0; y < centerY; ++y) {
-        uint8_t *in = image.scanLine(y) + alphaOffset;
-        uint8_t *out = in + (width - 1) * stride;
+    for (const BlurArea &area : areas) {
+        appendBlurJobs(rowJobs, &area, area.height);
+        appendBlurJobs(columnJobs, &area, area.width);
+    }
 
-        for (int x = 0; x < centerX; ++x, in += stride, out -= stride) {
-            *out = *in;
-        }
+    if (rowJobs.isEmpty()) {
+        return;
     }
 
-    for (int y = 0; y < centerY; ++y) {
-        const uint8_t *in = image.scanLine(y) + alphaOffset;
-        uint8_t *out = image.scanLine(width - y - 1) + alphaOffset;
+    // The vertical pass needs the result of the horizontal pass, so one has
+    // to be finished before the other can start.
+    runBlurJobs(rowJobs, boxBlurRowsAlpha);
+    runBlurJobs(columnJobs, boxBlurColumnsAlpha);
+}
 
-        for (int x = 0; x < width; ++x, in += stride, out += stride) {
-            *out = *in;
+bool boxBlurAlphaWithKernel(QImage &image, int radius, BoxBlurKernel kernel)
+{
+    BlurArea area = blurArea(image, radius);
+
+    switch (kernel) {
+    case BoxBlurKernel::Scalar:
+        area.blurLanes = nullptr;
+        break;
+#if BREEZE_HAVE_VECTOR_BLUR
+    case BoxBlurKernel::Vector:
+        area.blurLanes = boxBlurLanesAlpha3Generic;
+        break;
+#if defined(__x86_64__) || defined(__i386__)
+    case BoxBlurKernel::Avx2:
+        if (!__builtin_cpu_supports("avx2")) {
+            return false;
         }
+        area.blurLanes = boxBlurLanesAlpha3Avx2;
+        break;
+#endif
+#endif
+    default:
+        return false;
     }
+
+    boxBlurAlpha({area});
+    return true;
 }
 
-static void renderShadow(QPainter *painter, const QRect &rect, qreal borderRadius, const QPoint &offset, int radius, const QColor &color)
+/**
+ * Paint the box of a shadow, ready to be blurred.
+ *
+ * @param boxSize The size of the box.
+ * @param borderRadius The border radius of the box.
+ * @param radius The blur radius.
+ * @param dpr The device pixel ratio of the shadow.
+ **/
+static QImage paintShadowBox(const QSize &boxSize, qreal borderRadius, int radius, qreal dpr)
 {
-    const QSize inflation = calculateBlurExtent(radius);
-    const QSize size = rect.size() + 2 * inflation;
+    const int extent = BoxShadowRenderer::calculateBlurExtent(radius);
+    const QSize size = boxSize + 2 * QSize(extent, extent);
 
-    const qreal dpr = painter->device()->devicePixelRatioF();
-
-    QImage shadow(size * dpr, QImage::Format_ARGB32_Premultiplied);
+    QImage shadow(size * dpr, QImage::Format_Alpha8);
     shadow.setDevicePixelRatio(dpr);
-    shadow.fill(Qt::transparent);
+    shadow.fill(0);
 
-    QRect boxRect(QPoint(0, 0), rect.size());
+    QRect boxRect(QPoint(0, 0), boxSize);
     boxRect.moveCenter(QRect(QPoint(0, 0), size).center());
 
     const qreal xRadius = 2.0 * borderRadius / boxRect.width();
@@ -264,24 +624,170 @@ static void renderShadow(QPainter *painter, const QRect &rect, qreal borderRadiu
     shadowPainter.drawRoundedRect(boxRect, xRadius, yRadius);
     shadowPainter.end();
 
-    // Because the shadow texture is symmetrical, that's enough to blur
-    // only the top-left quadrant and then mirror it.
-    const QRect blurRect(0, 0, qCeil(shadow.width() * 0.5), qCeil(shadow.height() * 0.5));
-    const int scaledRadius = qRound(radius * dpr);
-    boxBlurAlpha(shadow, scaledRadius, blurRect);
-    mirrorTopLeftQuadrant(shadow);
+    return shadow;
+}
 
-    // Give the shadow a tint of the desired color.
-    shadowPainter.begin(&shadow);
-    shadowPainter.setCompositionMode(QPainter::CompositionMode_SourceIn);
-    shadowPainter.fillRect(shadow.rect(), color);
-    shadowPainter.end();
+/**
+ * Compute the blurred profile of a box along one axis.
+ *
+ * @param profile Blurred box, per pixel.
+ * @param corners Gaussian at both corner cutouts, per pixel.
+ * @param count The number of pixels.
+ * @param size The logical size of the image along the axis.
+ * @param halfBox Half the logical size of the box along the axis.
+ * @param cornerCenter Distance between the center of the box and the corner cutouts.
+ * @param sigma The standard deviation of the blur.
+ * @param dpr The device pixel ratio of the shadow.
+ **/
+static void computeShadowProfile(qreal *profile, qreal *corners, int count, qreal size,
+                                 qreal halfBox, qreal cornerCenter, qreal sigma, qreal dpr)
+{
+    const qreal erfScale = M_SQRT1_2 / sigma;
+    const qreal gaussianScale = 1.0 / (qSqrt(2.0 * M_PI) * sigma);
+    const qreal exponentScale = -0.5 / (sigma * sigma);
+
+    for (int i = 0; i < count; ++i) {
+        // Logical coordinates, relative to the center of the box.
+        const qreal p = (i + 0.5) / dpr - size * 0.5;
+
+        profile[i] = 0.5 * (std::erf((p + halfBox) * erfScale) - std::erf((p - halfBox) * erfScale));
+        corners[i] = gaussianScale * (qExp(exponentScale * (p - cornerCenter) * (p - cornerCenter))
+                                      + qExp(exponentScale * (p + cornerCenter) * (p + cornerCenter)));
+    }
+}
+
+/**
+ * Compute the top-left quadrant of a blurred rounded box in closed form.
+ *
+ * The Gaussian blur of a rectangle is separable, the product of two erf
+ * differences. Each rounded corner removes a small area from it, whose
+ * blur is approximated by that of a point mass at its centroid. This is
+ * separable too, so only a handful of transcendental functions per row
+ * and per column are evaluated.
+ *
+ * @param shadow The image, in Format_Alpha8, of the same geometry as paintShadowBox() would make.
+ * @param boxSize The size of the box.
+ * @param borderRadius The border radius of the box.
+ * @param radius The blur radius.
+ * @param dpr The device pixel ratio of the shadow.
+ **/
+static void computeShadowQuadrant(QImage &shadow, const QSize &boxSize, qreal borderRadius, int radius, qreal dpr)
+{
+    const int extent = BoxShadowRenderer::calculateBlurExtent(radius);
+    const QSize size = boxSize + 2 * QSize(extent, extent);
+    const qreal sigma = calculateBlurStdDev(radius);
+
+    const qreal halfWidth = boxSize.width() * 0.5;
+    const qreal halfHeight = boxSize.height() * 0.5;
+    const qreal corner = qMin(borderRadius, qMin(halfWidth, halfHeight));
+
+    // The area between a corner square and its quarter disc, and how far
+    // its centroid lies from the center of the disc, along each axis.
+    const qreal cornerArea = (1.0 - M_PI / 4.0) * corner * corner;
+    const qreal cornerOffset = corner / (6.0 * (1.0 - M_PI / 4.0));
+
+    const int quadrantWidth = qCeil(shadow.width() * 0.5);
+    const int quadrantHeight = qCeil(shadow.height() * 0.5);
+
+    QVector<qreal> profiles(2 * (quadrantWidth + quadrantHeight));
+    qreal *profileX = profiles.data();
+    qreal *cornersX = profileX + quadrantWidth;
+    qreal *profileY = cornersX + quadrantWidth;
+    qreal *cornersY = profileY + quadrantHeight;
+
+    computeShadowProfile(profileX, cornersX, quadrantWidth, size.width(),
+                         halfWidth, halfWidth - corner + cornerOffset, sigma, dpr);
+    computeShadowProfile(profileY, cornersY, quadrantHeight, size.height(),
+                         halfHeight, halfHeight - corner + cornerOffset, sigma, dpr);
+
+    for (int y = 0; y < quadrantHeight; ++y) {
+        const qreal rowProfile = 255 * profileY[y];
+        const qreal rowCorners = 255 * cornerArea * cornersY[y];
+
+        uint8_t *line = shadow.scanLine(y);
+        for (int x = 0; x < quadrantWidth; ++x) {
+            const qreal value = profileX[x] * rowProfile - cornersX[x] * rowCorners;
+            line[x] = uint8_t(qBound(0.0, value, 255.0) + 0.5);
+        }
+    }
+}
+
+/**
+ * Compute the shadow of a box in closed form, ready to be mirrored.
+ *
+ * @param boxSize The size of the box.
+ * @param borderRadius The border radius of the box.
+ * @param radius The blur radius.
+ * @param dpr The device pixel ratio of the shadow.
+ **/
+static QImage computeShadowBox(const QSize &boxSize, qreal borderRadius, int radius, qreal dpr)
+{
+    const int extent = BoxShadowRenderer::calculateBlurExtent(radius);
+    const QSize size = boxSize + 2 * QSize(extent, extent);
+
+    QImage shadow(size * dpr, QImage::Format_Alpha8);
+    shadow.setDevicePixelRatio(dpr);
+    computeShadowQuadrant(shadow, boxSize, borderRadius, radius, dpr);
+
+    return shadow;
+}
+
+/**
+ * Multiply all components of a premultiplied pixel by an alpha value, the
+ * same way the raster paint engine does.
+ **/
+static inline uint32_t multiplyPixel(uint32_t pixel, uint32_t alpha)
+{
+    uint32_t redBlue = (pixel & 0xff00ff) * alpha;
+    redBlue = (redBlue + ((redBlue >> 8) & 0xff00ff) + 0x800080) >> 8;
 
-    // Actually, present the shadow.
-    QRect shadowRect = shadow.rect();
-    shadowRect.setSize(shadowRect.size() / dpr);
+    uint32_t alphaGreen = ((pixel >> 8) & 0xff00ff) * alpha;
+    alphaGreen = alphaGreen + ((alphaGreen >> 8) & 0xff00ff) + 0x800080;
+
+    return (alphaGreen & 0xff00ff00) | (redBlue & 0xff00ff);
+}
+
+/**
+ * Present a shadow on the canvas.
+ *
+ * This mirrors the top-left quadrant of the shadow, gives it a tint of the
+ * desired color, and blends it over the canvas, all in one pass.
+ *
+ * @param canvas The canvas, in Format_ARGB32_Premultiplied.
+ * @param rect The box, in logical coordinates of the canvas.
+ * @param offset The offset of the shadow.
+ * @param shadow The shadow, in Format_Alpha8. Only its top-left quadrant is read.
+ * @param color The color of the shadow.
+ **/
+static void renderShadow(QImage &canvas, const QRect &rect, const QPoint &offset, const QImage &shadow, const QColor &color)
+{
+    const qreal dpr = canvas.devicePixelRatioF();
+    QRect shadowRect(QPoint(0, 0), shadow.size() / dpr);
     shadowRect.moveCenter(rect.center() + offset);
-    painter->drawImage(shadowRect, shadow);
+
+    const QPoint origin = shadowRect.topLeft() * dpr;
+    const QRect target = QRect(origin, shadow.size()).intersected(canvas.rect());
+
+    const int width = shadow.width();
+    const int height = shadow.height();
+    const uint32_t pixel = qPremultiply(color.rgba());
+
+    for (int y = target.top(); y <= target.bottom(); ++y) {
+        const int shadowY = y - origin.y();
+        const uint8_t *in = shadow.constScanLine(qMin(shadowY, height - 1 - shadowY));
+        uint32_t *out = reinterpret_cast<uint32_t *>(canvas.scanLine(y));
+
+        for (int x = target.left(); x <= target.right(); ++x) {
+            const int shadowX = x - origin.x();
+            const uint32_t source = multiplyPixel(pixel, in[qMin(shadowX, width - 1 - shadowX)]);
+            out[x] = source + multiplyPixel(out[x], 255 - qAlpha(source));
+        }
+    }
+}
+
+void BoxShadowRenderer::setMethod(Method method)
+{
+    m_method = method;
 }
 
 void BoxShadowRenderer::setBoxSize(const QSize &size)
@@ -294,6 +800,11 @@ void BoxShadowRenderer::setBorderRadius(qreal radius)
     m_borderRadius = radius;
 }
 
+void BoxShadowRenderer::setDevicePixelRatio(qreal dpr)
+{
+    m_dpr = dpr;
+}
+
 void BoxShadowRenderer::addShadow(const QPoint &offset, int radius, const QColor &color)
 {
     Shadow shadow = {};
@@ -315,30 +826,44 @@ QImage BoxShadowRenderer::render() const
             calculateMinimumShadowTextureSize(m_boxSize, shadow.radius, shadow.offset));
     }
 
-    QImage canvas(canvasSize, QImage::Format_ARGB32_Premultiplied);
+    QImage canvas(canvasSize * m_dpr, QImage::Format_ARGB32_Premultiplied);
+    canvas.setDevicePixelRatio(m_dpr);
     canvas.fill(Qt::transparent);
 
     QRect boxRect(QPoint(0, 0), m_boxSize);
     boxRect.moveCenter(QRect(QPoint(0, 0), canvasSize).center());
 
-    QPainter painter(&canvas);
+    const qreal dpr = canvas.devicePixelRatioF();
+
+    // Because the shadow texture is symmetrical, that's enough to compute
+    // only the top-left quadrant and then mirror it. The shadows don't
+    // depend on each other, so they're all blurred at once. They are kept
+    // in Alpha8 buffers until colorized on the canvas.
+    QVector<QImage> shadows;
+    QVector<BlurArea> areas;
+    shadows.reserve(m_shadows.count());
     for (const Shadow &shadow : qAsConst(m_shadows)) {
-        renderShadow(&painter, boxRect, m_borderRadius, shadow.offset, shadow.radius, shadow.color);
+        const int scaledRadius = qRound(shadow.radius * dpr);
+        if (scaledRadius < 2) {
+            shadows.append(paintShadowBox(m_boxSize, m_borderRadius, shadow.radius, dpr));
+        } else if (m_method == Method::Analytic) {
+            shadows.append(computeShadowBox(m_boxSize, m_borderRadius, shadow.radius, dpr));
+        } else {
+            shadows.append(paintShadowBox(m_boxSize, m_borderRadius, shadow.radius, dpr));
+
+            QImage &image = shadows.last();
+            const QRect blurRect(0, 0, qCeil(image.width() * 0.5), qCeil(image.height() * 0.5));
+            areas.append(blurArea(image, scaledRadius, blurRect));
+        }
     }
-    painter.end();
+    boxBlurAlpha(areas);
 
-    return canvas;
-}
-
-QSize BoxShadowRenderer::calculateMinimumBoxSize(int radius)
-{
-    const QSize blurExtent = calculateBlurExtent(radius);
-    return 2 * blurExtent + QSize(1, 1);
-}
+    for (int i = 0; i < m_shadows.count(); ++i) {
+        const Shadow &shadow = m_shadows.at(i);
+        renderShadow(canvas, boxRect, shadow.offset, shadows.at(i), shadow.color);
+    }
 
-QSize BoxShadowRenderer::calculateMinimumShadowTextureSize(const QSize &boxSize, int radius, const QPoint &offset)
-{
-    return boxSize + 2 * calculateBlurExtent(radius) + QSize(qAbs(offset.x()), qAbs(offset.y()));
+    return canvas;
 }
 
 } // namespace Breeze
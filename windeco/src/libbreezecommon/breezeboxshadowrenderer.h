@@ -23,6 +23,20 @@ class BREEZECOMMON_EXPORT BoxShadowRenderer
 public:
     // Compiler generated constructors & destructor are fine.
 
+    /**
+     * How shadows are computed.
+     **/
+    enum class Method {
+        BoxBlur,  ///< Paint the box, then blur it with three box filters.
+        Analytic, ///< Evaluate the blurred box in closed form, without intermediate canvas.
+    };
+
+    /**
+     * Set how shadows are computed. Defaults to Method::BoxBlur.
+     * @param method The method.
+     **/
+    void setMethod(Method method);
+
     /**
      * Set the size of the box.
      * @param size The size of the box.
@@ -35,6 +49,12 @@ public:
      **/
     void setBorderRadius(qreal radius);
 
+    /**
+     * Set the device pixel ratio of the resulting shadow texture.
+     * @param dpr The device pixel ratio.
+     **/
+    void setDevicePixelRatio(qreal dpr);
+
     /**
      * Add a shadow.
      * @param offset The offset of the shadow.
@@ -48,6 +68,13 @@ public:
      **/
     QImage render() const;
 
+    /**
+     * Calculate how far a shadow extends beyond its box.
+     *
+     * @param radius The blur radius of the shadow.
+     **/
+    static constexpr int calculateBlurExtent(int radius);
+
     /**
      * Calculate the minimum size of the box.
      *
@@ -56,7 +83,7 @@ public:
      *
      * @param radius The blur radius of the shadow.
      **/
-    static QSize calculateMinimumBoxSize(int radius);
+    static constexpr QSize calculateMinimumBoxSize(int radius);
 
     /**
      * Calculate the minimum size of the shadow texture.
@@ -68,11 +95,13 @@ public:
      * @param radius The blur radius.
      * @param offset The offset of the shadow.
      **/
-    static QSize calculateMinimumShadowTextureSize(const QSize &boxSize, int radius, const QPoint &offset);
+    static constexpr QSize calculateMinimumShadowTextureSize(const QSize &boxSize, int radius, const QPoint &offset);
 
 private:
     QSize m_boxSize;
     qreal m_borderRadius = 0.0;
+    qreal m_dpr = 1.0;
+    Method m_method = Method::BoxBlur;
 
     struct Shadow {
         QPoint offset;
@@ -83,4 +112,23 @@ private:
     QVector<Shadow> m_shadows;
 };
 
+constexpr int BoxShadowRenderer::calculateBlurExtent(int radius)
+{
+    // The standard deviation is half the blur radius, see https://www.w3.org/TR/css-backgrounds-3/#shadow-blur
+    // It is approximated by three box filters, see https://www.w3.org/TR/SVG11/filters.html#feGaussianBlurElement
+    // whose total size is 3 * sqrt(2 * pi) / 4 * 1.5 times that.
+    return qMax(2, int(radius * 0.5 * 2.8199568089598754 + 0.5));
+}
+
+constexpr QSize BoxShadowRenderer::calculateMinimumBoxSize(int radius)
+{
+    return QSize(2 * calculateBlurExtent(radius) + 1, 2 * calculateBlurExtent(radius) + 1);
+}
+
+constexpr QSize BoxShadowRenderer::calculateMinimumShadowTextureSize(const QSize &boxSize, int radius, const QPoint &offset)
+{
+    return QSize(boxSize.width() + 2 * calculateBlurExtent(radius) + qAbs(offset.x()),
+                 boxSize.height() + 2 * calculateBlurExtent(radius) + qAbs(offset.y()));
+}
+
 } // namespace Breeze
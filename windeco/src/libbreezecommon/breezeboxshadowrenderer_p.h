@@ -0,0 +1,40 @@
+/*
+ * SPDX-FileCopyrightText: 2018 Vlad Zahorodnii <vlad.zahorodnii@kde.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+// own
+#include "breezecommon_export.h"
+
+// Qt
+#include <QImage>
+
+// Internals of BoxShadowRenderer, exposed for autotests. Not part of the API.
+
+namespace Breeze
+{
+
+/**
+ * Ways to blur the lines of an alpha channel.
+ **/
+enum class BoxBlurKernel {
+    Scalar, ///< One line at a time.
+    Vector, ///< Several lines in lockstep, with the baseline instruction set.
+    Avx2,   ///< Several lines in lockstep, with AVX2.
+};
+
+/**
+ * Blur the alpha channel of an image with given kernel, the way
+ * BoxShadowRenderer blurs its shadows.
+ *
+ * @param image The image, in Format_Alpha8.
+ * @param radius The blur radius, in device pixels.
+ * @param kernel The kernel.
+ * @returns false if the compiler or the CPU doesn't support the kernel.
+ **/
+BREEZECOMMON_EXPORT bool boxBlurAlphaWithKernel(QImage &image, int radius, BoxBlurKernel kernel);
+
+} // namespace Breeze